@@ -0,0 +1,202 @@
+#ifndef __CONNECTIVITY_HPP__
+#define __CONNECTIVITY_HPP__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "FileMap.hpp"
+#include "Filesystem.hpp"
+
+// Columnar thread structure, stored in the conncol file:
+//   ConnectivityHeader
+//   uint32_t date[messages]
+//   int32_t parent[messages]           -1 for top level messages
+//   uint32_t subtree[messages]         message itself, and all its descendants
+//   uint32_t childOffset[messages+1]   children of message i are at [childOffset[i], childOffset[i+1])
+//   uint32_t children[children]
+//   uint32_t root[messages]            top level message of the thread
+// Files of any other version, or not matching the layout, are rejected.
+enum : uint32_t { ConnectivityVersion = 1 };
+
+struct ConnectivityHeader
+{
+    uint32_t version;
+    uint32_t messages;
+    uint32_t children;
+    uint32_t reserved;
+};
+
+// Top level message of each thread, found by following parent links.
+template<class Parent>
+static std::vector<uint32_t> BuildConnectivityRoots( uint32_t size, Parent parent )
+{
+    enum : uint32_t { Unset = 0xFFFFFFFF };
+    std::vector<uint32_t> root( size, Unset );
+    std::vector<uint32_t> chain;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        chain.clear();
+        uint32_t idx = i;
+        uint32_t top;
+        for(;;)
+        {
+            if( root[idx] != Unset )
+            {
+                top = root[idx];
+                break;
+            }
+            chain.emplace_back( idx );
+            const int32_t p = parent( idx );
+            if( p < 0 )
+            {
+                top = idx;
+                break;
+            }
+            idx = uint32_t( p );
+        }
+        for( auto& v : chain ) root[v] = top;
+    }
+    return root;
+}
+
+// Reads conncol, or the interleaved { date, parent, subtree, childnum, children... }
+// records referenced by connmeta, used by older archives.
+class ConnectivityView
+{
+public:
+    ConnectivityView( const std::string& base )
+        : m_col( base + "conncol", true )
+        , m_meta( Exists( base + "conncol" ) ? std::string() : base + "connmeta", true )
+        , m_data( Exists( base + "conncol" ) ? std::string() : base + "conndata", true )
+    {
+        if( !m_col && !m_meta )
+        {
+            fprintf( stderr, "Cannot open connectivity data in %s\n", base.c_str() );
+            exit( 1 );
+        }
+        Init();
+    }
+
+    ConnectivityView( const FileMapPtrs& col, const FileMapPtrs& meta, const FileMapPtrs& data )
+        : m_col( col )
+        , m_meta( meta )
+        , m_data( data )
+    {
+        Init();
+    }
+
+    size_t Size() const { return m_size; }
+    bool IsColumnar() const { return m_date != nullptr; }
+
+    uint32_t Date( uint32_t idx ) const { assert( idx < m_size ); return m_date ? m_date[idx] : Record( idx )[0]; }
+    int32_t Parent( uint32_t idx ) const { assert( idx < m_size ); return m_date ? m_parent[idx] : int32_t( Record( idx )[1] ); }
+    uint32_t SubtreeSize( uint32_t idx ) const { assert( idx < m_size ); return m_date ? m_subtree[idx] : Record( idx )[2]; }
+    uint32_t ChildrenCount( uint32_t idx ) const { assert( idx < m_size ); return m_date ? m_childOffset[idx+1] - m_childOffset[idx] : Record( idx )[3]; }
+    const uint32_t* Children( uint32_t idx ) const { assert( idx < m_size ); return m_date ? m_children + m_childOffset[idx] : Record( idx ) + 4; }
+    uint32_t Root( uint32_t idx ) const
+    {
+        assert( idx < m_size );
+        if( m_date ) return m_root[idx];
+        // Interleaved records have no root, it is found by following parents.
+        int32_t parent;
+        while( ( parent = int32_t( Record( idx )[1] ) ) >= 0 ) idx = uint32_t( parent );
+        return idx;
+    }
+
+    void Advise( uint32_t access ) const { m_col.Advise( access ); m_meta.Advise( access ); m_data.Advise( access ); }
+
+private:
+    void Init()
+    {
+        m_date = nullptr;
+        if( m_col )
+        {
+            auto hdr = (const ConnectivityHeader*)(const char*)m_col;
+            if( m_col.Size() < sizeof( ConnectivityHeader ) || hdr->version != ConnectivityVersion ||
+                m_col.Size() != sizeof( ConnectivityHeader ) + ( uint64_t( hdr->messages ) * 5 + 1 + hdr->children ) * sizeof( uint32_t ) )
+            {
+                fprintf( stderr, "Unsupported connectivity data layout. Rebuild it with connectivity.\n" );
+                exit( 1 );
+            }
+            m_size = hdr->messages;
+            m_date = (const uint32_t*)( m_col + sizeof( ConnectivityHeader ) );
+            m_parent = (const int32_t*)( m_date + m_size );
+            m_subtree = (const uint32_t*)( m_parent + m_size );
+            m_childOffset = m_subtree + m_size;
+            m_children = m_childOffset + m_size + 1;
+            m_root = m_children + hdr->children;
+        }
+        else
+        {
+            m_size = m_meta.DataSize();
+        }
+    }
+
+    const uint32_t* Record( uint32_t idx ) const { return m_data + m_meta[idx] / sizeof( uint32_t ); }
+
+    const FileMap<char> m_col;
+    const FileMap<uint32_t> m_meta;
+    const FileMap<uint32_t> m_data;
+
+    size_t m_size;
+    const uint32_t* m_date;
+    const int32_t* m_parent;
+    const uint32_t* m_subtree;
+    const uint32_t* m_childOffset;
+    const uint32_t* m_children;
+    const uint32_t* m_root;
+};
+
+// Messages have to be added in index order.
+class ConnectivityWriter
+{
+public:
+    ConnectivityWriter( uint32_t size )
+    {
+        m_date.reserve( size );
+        m_parent.reserve( size );
+        m_subtree.reserve( size );
+        m_childOffset.reserve( size + 1 );
+        m_childOffset.emplace_back( 0 );
+    }
+
+    void Add( uint32_t date, int32_t parent, uint32_t subtree, const uint32_t* children, uint32_t num )
+    {
+        m_date.emplace_back( date );
+        m_parent.emplace_back( parent );
+        m_subtree.emplace_back( subtree );
+        m_children.insert( m_children.end(), children, children + num );
+        m_childOffset.emplace_back( m_children.size() );
+    }
+
+    // Writes conncol and removes interleaved data files left by older tools.
+    void Write( const std::string& base ) const
+    {
+        const ConnectivityHeader hdr = { ConnectivityVersion, uint32_t( m_date.size() ), uint32_t( m_children.size() ), 0 };
+        FILE* f = fopen( ( base + "conncol" ).c_str(), "wb" );
+        fwrite( &hdr, 1, sizeof( hdr ), f );
+        fwrite( m_date.data(), 1, m_date.size() * sizeof( uint32_t ), f );
+        fwrite( m_parent.data(), 1, m_parent.size() * sizeof( int32_t ), f );
+        fwrite( m_subtree.data(), 1, m_subtree.size() * sizeof( uint32_t ), f );
+        fwrite( m_childOffset.data(), 1, m_childOffset.size() * sizeof( uint32_t ), f );
+        fwrite( m_children.data(), 1, m_children.size() * sizeof( uint32_t ), f );
+        const auto root = BuildConnectivityRoots( uint32_t( m_parent.size() ), [this] ( uint32_t idx ) { return m_parent[idx]; } );
+        fwrite( root.data(), 1, root.size() * sizeof( uint32_t ), f );
+        fclose( f );
+
+        remove( ( base + "connmeta" ).c_str() );
+        remove( ( base + "conndata" ).c_str() );
+    }
+
+private:
+    std::vector<uint32_t> m_date;
+    std::vector<int32_t> m_parent;
+    std::vector<uint32_t> m_subtree;
+    std::vector<uint32_t> m_childOffset;
+    std::vector<uint32_t> m_children;
+};
+
+#endif
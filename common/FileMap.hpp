@@ -1,6 +1,7 @@
 #ifndef __FILEMAP_HPP__
 #define __FILEMAP_HPP__
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -14,11 +15,52 @@ struct FileMapPtrs
     uint64_t size;
 };
 
+// Access policy hints, may be combined.
+struct FileAccess
+{
+    enum type : uint32_t {
+        Normal      = 0,
+        Sequential  = 1 << 0,   // read front to back, aggressive readahead
+        Random      = 1 << 1,   // hash lookups, no readahead
+        Populate    = 1 << 2,   // pre-fault everything on open
+        Lock        = 1 << 3,   // keep resident, implies populate
+    };
+};
+
+// Touches every page of the range, so that it is read in and mapped.
+static inline void Prefault( const char* ptr, uint64_t size )
+{
+    if( size == 0 ) return;
+    const auto page = PageSize();
+    volatile char sink = 0;
+    for( uint64_t i=0; i<size; i+=page ) sink += ptr[i];
+    sink += ptr[size-1];
+}
+
+static inline void AdviseRange( const void* ptr, uint64_t size, uint32_t access )
+{
+    if( !ptr || size == 0 || access == FileAccess::Normal ) return;
+    const auto begin = uintptr_t( ptr ) & ~uintptr_t( PageSize() - 1 );
+    const auto len = uintptr_t( ptr ) + size - begin;
+    if( access & FileAccess::Sequential ) madvise( (void*)begin, len, MADV_SEQUENTIAL );
+    if( access & FileAccess::Random ) madvise( (void*)begin, len, MADV_RANDOM );
+    if( access & FileAccess::Lock )
+    {
+        // May fail due to RLIMIT_MEMLOCK. It's only a hint, so fall back to populate.
+        if( mlock( (void*)begin, len ) == 0 ) return;
+    }
+    if( access & ( FileAccess::Populate | FileAccess::Lock ) )
+    {
+        madvise( (void*)begin, len, MADV_WILLNEED );
+        Prefault( (const char*)ptr, size );
+    }
+}
+
 template<typename T>
 class FileMap
 {
 public:
-    FileMap( const std::string& fn, bool mayFail = false )
+    FileMap( const std::string& fn, bool mayFail = false, uint32_t access = FileAccess::Normal )
         : m_ptr( nullptr )
         , m_size( GetFileSize( fn.c_str() ) )
         , m_release( true )
@@ -30,15 +72,18 @@ public:
             fprintf( stderr, "Cannot open %s\n", fn.c_str() );
             exit( 1 );
         }
-        m_ptr = (T*)mmap( nullptr, m_size, PROT_READ, MAP_SHARED, fileno( f ), 0 );
+        const int flags = ( access & ( FileAccess::Populate | FileAccess::Lock ) ) ? MAP_SHARED | MAP_POPULATE : MAP_SHARED;
+        m_ptr = (T*)mmap( nullptr, m_size, PROT_READ, flags, fileno( f ), 0 );
         fclose( f );
+        Advise( access );
     }
 
-    FileMap( const FileMapPtrs& ptrs )
+    FileMap( const FileMapPtrs& ptrs, uint32_t access = FileAccess::Normal )
         : m_ptr( (T*)ptrs.ptr )
         , m_size( ptrs.size )
         , m_release( false )
     {
+        Advise( access );
     }
 
     FileMap( const FileMap& ) = delete;
@@ -68,6 +113,19 @@ public:
         }
     }
 
+    // Hint that given byte range will be accessed soon, so that the kernel
+    // can start reading it in the background.
+    void Prefetch( uint64_t offset, uint64_t size ) const
+    {
+        if( !m_ptr || size == 0 ) return;
+        const auto begin = uintptr_t( m_ptr ) + offset;
+        const auto aligned = begin & ~uintptr_t( PageSize() - 1 );
+        madvise( (void*)aligned, begin + size - aligned, MADV_WILLNEED );
+    }
+
+    // Maps living inside a package only affect their own part of the file.
+    void Advise( uint32_t access ) const { AdviseRange( m_ptr, m_size, access ); }
+
     operator const T*() const { return m_ptr; }
     uint64_t Size() const { return m_size; }
     uint64_t DataSize() const { return m_size / sizeof( T ); }
@@ -8,6 +8,7 @@
 
 #include "../common/FileMap.hpp"
 #include "../common/MsgIdHash.hpp"
+#include "../common/PerfectHash.hpp"
 
 template<class T>
 class HashSearch
@@ -19,76 +20,98 @@ class HashSearch
     };
 
 public:
-    HashSearch( const std::string& data, const std::string& hash, const std::string& hashdata )
+    // Perfect hash is optional. If present, it is used instead of the hash table, which may then be empty.
+    HashSearch( const std::string& data, const std::string& hash, const std::string& hashdata, const std::string& phf = std::string() )
         : m_data( data )
-        , m_hash( hash )
-        , m_mask( m_hash.DataSize() - 1 )
+        , m_hash( hash, Exists( phf ), FileAccess::Random )
+        , m_phf( phf )
     {
         FileMap<char> distfile( hashdata );
-        m_distmax = distfile[0];
+        Init( distfile );
     }
 
-    HashSearch( const FileMapPtrs& data, const FileMapPtrs& hash, const FileMapPtrs& hashdata )
+    HashSearch( const FileMapPtrs& data, const FileMapPtrs& hash, const FileMapPtrs& hashdata, const FileMapPtrs& phf = FileMapPtrs { nullptr, 0 } )
         : m_data( data )
-        , m_hash( hash )
-        , m_mask( m_hash.DataSize() - 1 )
+        , m_hash( hash, FileAccess::Random )
+        , m_phf( phf )
     {
         FileMap<char> distfile( hashdata );
-        m_distmax = distfile[0];
+        Init( distfile );
     }
 
-    int Search( const T* str, XXH32_hash_t _hash ) const;
-    int Search( const T* str ) const;
+    int Search( const T* str, XXH32_hash_t _hash ) const
+    {
+        if( m_phf ) return SearchPerfect( (const char*)str, strlen( (const char*)str ) );
+        return m_tagged ? SearchTagged( (const char*)str, _hash ) : SearchPlain( (const char*)str, _hash );
+    }
+
+    int Search( const T* str ) const
+    {
+        const auto len = strlen( (const char*)str );
+        if( m_phf ) return SearchPerfect( (const char*)str, len );
+        return Search( str, XXH32( str, len, 0 ) );
+    }
+
+    void Advise( uint32_t access ) const { m_hash.Advise( access ); m_data.Advise( access ); }
 
 private:
-    FileMap<T> m_data;
-    FileMap<Data> m_hash;
-    uint32_t m_mask;
-    uint8_t m_distmax;
-};
+    void Init( const FileMap<char>& distfile )
+    {
+        m_distmax = distfile[0];
+        m_tagged = distfile.Size() > 1 && distfile[1] == HashLayoutTagged;
+        m_mask = m_hash.Size() / sizeof( Data ) - 1;
+    }
 
-template<>
-inline int HashSearch<uint8_t>::Search( const uint8_t* str, XXH32_hash_t _hash ) const
-{
-    auto hash = _hash & m_mask;
-    uint8_t dist = 0;
-    for(;;)
+    const char* String( uint32_t offset ) const { return (const char*)( m_data + offset ); }
+
+    int SearchPlain( const char* str, XXH32_hash_t _hash ) const
     {
-        auto& h = m_hash[hash];
-        if( h.offset == 0 ) return -1;
-        if( strcmp( (const char*)str, (const char*)(const uint8_t*)m_data + h.offset ) == 0 ) return h.idx;
-        dist++;
-        if( dist > m_distmax ) return -1;
-        hash = (hash+1) & m_mask;
+        auto table = (const Data*)(const char*)m_hash;
+        auto hash = _hash & m_mask;
+        uint8_t dist = 0;
+        for(;;)
+        {
+            auto& h = table[hash];
+            if( h.offset == 0 ) return -1;
+            if( strcmp( str, String( h.offset ) ) == 0 ) return h.idx;
+            dist++;
+            if( dist > m_distmax ) return -1;
+            hash = (hash+1) & m_mask;
+        }
     }
-}
 
-template<>
-inline int HashSearch<char>::Search( const char* str, XXH32_hash_t _hash ) const
-{
-    auto hash = _hash & m_mask;
-    uint8_t dist = 0;
-    for(;;)
+    int SearchPerfect( const char* str, size_t len ) const
     {
-        auto& h = m_hash[hash];
-        if( h.offset == 0 ) return -1;
-        if( strcmp( str, m_data + h.offset ) == 0 ) return h.idx;
-        dist++;
-        if( dist > m_distmax ) return -1;
-        hash = (hash+1) & m_mask;
+        auto h = m_phf.Find( str, len );
+        if( !h || strcmp( str, String( h->offset ) ) != 0 ) return -1;
+        return h->idx;
     }
-}
 
-template<>
-inline int HashSearch<uint8_t>::Search( const uint8_t* str ) const
-{
-    return Search( str, XXH32( str, strlen( (const char*)str ), 0 ) );
-}
+    // Top bits of the key hash are kept in each slot, so that probes for
+    // other keys are rejected without touching the string pool.
+    int SearchTagged( const char* str, XXH32_hash_t _hash ) const
+    {
+        auto table = (const Data*)(const char*)m_hash;
+        const auto tag = _hash & HashTagMask;
+        auto hash = _hash & m_mask;
+        uint8_t dist = 0;
+        for(;;)
+        {
+            auto& h = table[hash];
+            if( h.offset == 0 ) return -1;
+            if( ( h.idx & HashTagMask ) == tag && strcmp( str, String( h.offset ) ) == 0 ) return h.idx & HashIdxMask;
+            dist++;
+            if( dist > m_distmax ) return -1;
+            hash = (hash+1) & m_mask;
+        }
+    }
 
-template<>
-inline int HashSearch<char>::Search( const char* str ) const
-{
-    return Search( str, XXH32( str, strlen( str ), 0 ) );
-}
+    FileMap<T> m_data;
+    FileMap<char> m_hash;
+    uint32_t m_mask;
+    uint8_t m_distmax;
+    bool m_tagged;
+    PerfectHash<Data> m_phf;
+};
 
 #endif
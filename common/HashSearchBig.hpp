@@ -10,6 +10,7 @@
 #include "../common/FileMap.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/MsgIdHash.hpp"
+#include "../common/PerfectHash.hpp"
 
 class HashSearchBig
 {
@@ -20,10 +21,11 @@ class HashSearchBig
     };
 
 public:
-    HashSearchBig( const std::string& msgid, const std::string& hashmeta, const std::string& hashdata )
+    HashSearchBig( const std::string& msgid, const std::string& hashmeta, const std::string& hashdata, const std::string& phf = std::string() )
         : m_data( msgid )
-        , m_hash( hashdata )
+        , m_hash( hashdata, false, FileAccess::Random )
         , m_mask( m_hash.DataSize() - 1 )
+        , m_phf( phf )
     {
         FileMap<char> distfile( hashmeta );
         m_distmax = distfile[0];
@@ -31,6 +33,7 @@ public:
 
     int Search( const uint8_t* str, XXH32_hash_t _hash ) const
     {
+        if( m_phf ) return SearchPerfect( str, strlen( (const char*)str ) );
         auto hash = _hash & m_mask;
         uint8_t dist = 0;
         for(;;)
@@ -45,14 +48,24 @@ public:
 
     int Search( const uint8_t* str ) const
     {
-        return Search( str, XXH32( str, strlen( (const char*)str ), 0 ) );
+        const auto len = strlen( (const char*)str );
+        if( m_phf ) return SearchPerfect( str, len );
+        return Search( str, XXH32( str, len, 0 ) );
     }
 
 private:
+    int SearchPerfect( const uint8_t* str, size_t len ) const
+    {
+        auto h = m_phf.Find( (const char*)str, len );
+        if( !h || strcmp( (const char*)str, (const char*)(const uint8_t*)m_data + h->offset ) != 0 ) return -1;
+        return h->idx;
+    }
+
     FileMap<uint8_t> m_data;
     FileMap<Data> m_hash;
     uint32_t m_mask;
     uint8_t m_distmax;
+    PerfectHash<Data> m_phf;
 };
 
 #endif
@@ -7,25 +7,11 @@
 #include "ICU.hpp"
 #include "LexiconTypes.hpp"
 #include "Slab.hpp"
+#include "WordSplit.hpp"
 
 UErrorCode wordItErr = U_ZERO_ERROR;
 auto wordIt = icu::BreakIterator::createWordInstance( icu::Locale::getEnglish(), wordItErr );
 
-static inline bool _isalpha( char c )
-{
-    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' );
-}
-
-static inline bool _isdigit( char c )
-{
-    return c >= '0' && c <= '9';
-}
-
-static inline bool _isalnum( char c )
-{
-    return _isalpha( c ) || _isdigit( c );
-}
-
 static inline bool IsUtf( const char* begin, const char* end )
 {
     assert( begin <= end );
@@ -131,24 +117,7 @@ static void SplitASCII( const char* ptr, const char* end, std::vector<std::strin
     {
         bptr = ptr;
     }
-    const char* bend = bptr + size;
-    for(;;)
-    {
-        while( bptr < bend && !_isalnum( *bptr ) ) bptr++;
-        auto e = bptr+1;
-        while( e < bend && ( _isalnum( *e ) || *e == '_' || ( e < bend-1 && (
-            ( _isalpha( e[-1] ) && _isalpha( e[1] ) && ( *e == ':' || *e == '.' || *e == '\'' ) ) ||
-            ( _isdigit( e[-1] ) && _isdigit( e[1] ) && ( *e == ',' || *e == '.' || *e == '\'' || *e == ';' ) )
-            ) ) ) ) e++;
-        while( e > bptr+2 && e[-1] == '_' ) e--;
-        auto len = e - bptr;
-        if( len >= LexiconMinLen && len <= LexiconMaxLen )
-        {
-            out.emplace_back( std::string( bptr, e ) );
-        }
-        if( e >= bend ) break;
-        bptr = e+1;
-    }
+    SplitASCIIWords( bptr, bptr + size, [&out] ( const char* ptr, uint32_t len ) { out.emplace_back( std::string( ptr, len ) ); } );
 }
 
 void SplitLine( const char* ptr, const char* end, std::vector<std::string>& out, bool toLower )
@@ -156,36 +125,9 @@ void SplitLine( const char* ptr, const char* end, std::vector<std::string>& out,
     assert( ptr != end );
     out.clear();
 
-    if( IsUtf( ptr, end ) )
-    {
-        while( ptr <= end )
-        {
-            auto putf = ptr;
-            while( putf < end && ( *putf & 0x80 ) == 0 ) putf++;
-            if( putf == end )
-            {
-                if( ptr != end )
-                {
-                    SplitASCII( ptr, end, out, toLower );
-                }
-                break;
-            }
-            auto split = putf;
-            while( split > ptr && *split != ' ' && *split != '\t' ) split--;
-            if( split > ptr )
-            {
-                SplitASCII( ptr, split, out, toLower );
-                ptr = split+1;
-            }
-            while( putf < end && *putf != ' ' && *putf != '\t' ) putf++;
-            SplitICU( ptr, putf, out, toLower );
-            ptr = putf + 1;
-        }
-    }
-    else
-    {
-        SplitASCII( ptr, end, out, toLower );
-    }
+    SplitTextRuns( ptr, end,
+        [&out, toLower] ( const char* begin, const char* end ) { SplitASCII( begin, end, out, toLower ); },
+        [&out, toLower] ( const char* begin, const char* end ) { SplitICU( begin, end, out, toLower ); } );
 }
 
 std::string ToLower( const char* ptr, const char* end )
@@ -0,0 +1,358 @@
+#ifndef __LEXICONDICTIONARY_HPP__
+#define __LEXICONDICTIONARY_HPP__
+
+#include <algorithm>
+#include <assert.h>
+#include <numeric>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include "FileMap.hpp"
+#include "LexiconTypes.hpp"
+
+// Sorted word dictionary, stored in the lexdict file:
+//   LexiconDictionaryHeader
+//   uint32_t order[words]              word indices, sorted by string
+//   LexiconGram gram[grams]            trigrams, sorted
+//   uint32_t gramWords[refs]           words containing gram i are at [gram[i].offset, gram[i+1].offset), ascending
+// Trigrams are taken from the word enclosed in LexiconGramEdge bytes, so
+// that patterns anchored at word start or end can use them too.
+struct LexiconDictionaryHeader
+{
+    uint32_t words;
+    uint32_t grams;
+    uint32_t refs;
+    uint32_t reserved;
+};
+
+struct LexiconGram
+{
+    uint32_t gram;
+    uint32_t offset;
+};
+
+enum : char { LexiconGramEdge = 1 };
+
+class LexiconDictionary
+{
+public:
+    // Maps lexdict. Older archives don't have it, the dictionary is then built from lexmeta and lexstr.
+    LexiconDictionary( const std::string& base )
+        : m_file( base + "lexdict", true )
+        , m_meta( base + "lexmeta" )
+        , m_str( base + "lexstr" )
+    {
+        if( m_file.Size() < sizeof( LexiconDictionaryHeader ) ) m_local = Build( m_meta, m_meta.DataSize(), m_str );
+        Init();
+    }
+
+    LexiconDictionary( const FileMapPtrs& dict, const FileMapPtrs& meta, const FileMapPtrs& str )
+        : m_file( dict )
+        , m_meta( meta )
+        , m_str( str )
+    {
+        if( m_file.Size() < sizeof( LexiconDictionaryHeader ) ) m_local = Build( m_meta, m_meta.DataSize(), m_str );
+        Init();
+    }
+
+    size_t Size() const { return m_hdr->words; }
+    const char* Word( uint32_t idx ) const { assert( idx < m_hdr->words ); return m_str + m_meta[idx].str; }
+
+    // Words starting with prefix, as a range of word indices in string order.
+    std::pair<const uint32_t*, const uint32_t*> Prefix( const char* prefix, size_t len ) const
+    {
+        const auto end = m_order + m_hdr->words;
+        const auto lo = std::lower_bound( m_order, end, prefix, [this, len] ( uint32_t l, const char* r ) { return strncmp( Word( l ), r, len ) < 0; } );
+        const auto hi = std::upper_bound( lo, end, prefix, [this, len] ( const char* l, uint32_t r ) { return strncmp( l, Word( r ), len ) < 0; } );
+        return std::make_pair( lo, hi );
+    }
+
+    // Appends indices of words matching pattern to out, in ascending order. A '*'
+    // in pattern stands for any, possibly empty, sequence of bytes.
+    void Match( const char* pattern, size_t len, std::vector<uint32_t>& out ) const
+    {
+        const auto pend = pattern + len;
+        const auto star = std::find( pattern, pend, '*' );
+        const auto start = out.size();
+
+        // Words sharing the head are a range of the sorted order. If the only
+        // wildcard ends the pattern, that's the answer.
+        const uint32_t* cand = nullptr;
+        const uint32_t* cend = nullptr;
+        bool sorted = false;
+        if( star != pattern )
+        {
+            const auto range = Prefix( pattern, star - pattern );
+            cand = range.first;
+            cend = range.second;
+            if( star == pend )
+            {
+                for( auto it = cand; it != cend; ++it )
+                {
+                    if( Word( *it )[len] == '\0' ) out.emplace_back( *it );
+                }
+                return;
+            }
+            if( star + 1 == pend )
+            {
+                out.insert( out.end(), cand, cend );
+                std::sort( out.begin() + start, out.end() );
+                return;
+            }
+        }
+
+        // Otherwise candidates come from the rarest trigram of the pattern's
+        // literal parts, if that's less than what the head gives.
+        char buf[3];
+        const char* seg = pattern;
+        for(;;)
+        {
+            const auto segend = std::find( seg, pend, '*' );
+            const bool edgeStart = seg == pattern;
+            const bool edgeEnd = segend == pend;
+            const int glen = int( segend - seg ) + edgeStart + edgeEnd;
+            for( int i=0; i+3<=glen; i++ )
+            {
+                for( int j=0; j<3; j++ )
+                {
+                    const auto p = i + j - edgeStart;
+                    buf[j] = p < 0 || p >= segend - seg ? LexiconGramEdge : seg[p];
+                }
+                const auto list = Gram( Pack( buf ) );
+                if( !cand || list.second - list.first < cend - cand )
+                {
+                    cand = list.first;
+                    cend = list.second;
+                    sorted = true;
+                }
+            }
+            if( segend == pend ) break;
+            seg = segend + 1;
+        }
+
+        if( !cand )
+        {
+            for( uint32_t i=0; i<m_hdr->words; i++ )
+            {
+                if( GlobMatch( pattern, pend, Word( i ) ) ) out.emplace_back( i );
+            }
+            return;
+        }
+        for( auto it = cand; it != cend; ++it )
+        {
+            if( GlobMatch( pattern, pend, Word( *it ) ) ) out.emplace_back( *it );
+        }
+        if( !sorted ) std::sort( out.begin() + start, out.end() );
+    }
+
+    // Appends indices of words within maxDist edits of word to out, together
+    // with their Levenshtein distance, counted in code points. Sorted order is
+    // walked as a trie: words sharing a prefix share rows of the distance
+    // table, and all words of a prefix which is already too far are skipped.
+    // Only the band of cells which can stay within maxDist is calculated.
+    void Similar( const char* word, int maxDist, std::vector<std::pair<uint32_t, uint32_t>>& out ) const
+    {
+        std::vector<uint32_t> query;
+        for( auto ptr = word; *ptr; ) query.emplace_back( Decode( ptr ) );
+        const auto qlen = query.size();
+        const auto width = qlen + 1;
+        const auto maxDepth = qlen + maxDist + 1;
+
+        std::vector<int> rows( ( maxDepth + 1 ) * width );
+        std::vector<uint32_t> offset( maxDepth + 1, 0 );
+        for( size_t j=0; j<width; j++ ) rows[j] = int( j );
+
+        const char* prev = "";
+        size_t depth = 0;
+        const auto end = m_order + m_hdr->words;
+        auto it = m_order;
+        while( it != end )
+        {
+            const auto str = Word( *it );
+            size_t d = 0;
+            while( d < depth && strncmp( prev + offset[d], str + offset[d], offset[d+1] - offset[d] ) == 0 ) d++;
+
+            bool far = false;
+            auto ptr = str + offset[d];
+            while( *ptr )
+            {
+                const auto c = Decode( ptr );
+                offset[d+1] = uint32_t( ptr - str );
+                const auto src = rows.data() + d * width;
+                const auto dst = src + width;
+                const auto lo = d + 1 > size_t( maxDist ) ? d + 1 - maxDist : 1;
+                const auto hi = std::min( qlen, d + 1 + maxDist );
+                dst[0] = int( d + 1 );
+                if( lo > 1 ) dst[lo-1] = maxDist + 1;
+                if( hi < qlen ) dst[hi+1] = maxDist + 1;
+                int min = dst[0];
+                for( size_t j=lo; j<=hi; j++ )
+                {
+                    dst[j] = std::min( { src[j] + 1, dst[j-1] + 1, src[j-1] + ( query[j-1] != c ) } );
+                    min = std::min( min, dst[j] );
+                }
+                d++;
+                if( min > maxDist )
+                {
+                    far = true;
+                    break;
+                }
+            }
+            prev = str;
+            depth = d;
+
+            if( far )
+            {
+                // Skipped ranges are mostly short, gallop before the binary search.
+                const auto len = offset[d];
+                auto last = it;
+                size_t step = 1;
+                while( size_t( end - last ) > step && strncmp( str, Word( last[step] ), len ) == 0 )
+                {
+                    last += step;
+                    step *= 2;
+                }
+                const auto bound = size_t( end - last ) > step ? last + step : end;
+                it = std::upper_bound( last + 1, bound, str, [this, len] ( const char* l, uint32_t r ) { return strncmp( l, Word( r ), len ) < 0; } );
+            }
+            else
+            {
+                if( qlen <= d + maxDist )
+                {
+                    const auto dist = rows[d * width + qlen];
+                    if( dist <= maxDist ) out.emplace_back( *it, uint32_t( dist ) );
+                }
+                ++it;
+            }
+        }
+    }
+
+    static void Write( const std::string& base, const LexiconMetaPacket* meta, uint32_t words, const char* str )
+    {
+        const auto data = Build( meta, words, str );
+        FILE* f = fopen( ( base + "lexdict" ).c_str(), "wb" );
+        fwrite( data.data(), 1, data.size() * sizeof( uint32_t ), f );
+        fclose( f );
+    }
+
+private:
+    static uint32_t Pack( const char* gram )
+    {
+        return ( uint32_t( uint8_t( gram[0] ) ) << 16 ) | ( uint32_t( uint8_t( gram[1] ) ) << 8 ) | uint8_t( gram[2] );
+    }
+
+    // Code point at ptr, which is advanced past it.
+    static uint32_t Decode( const char*& ptr )
+    {
+        const auto c = uint8_t( *ptr++ );
+        if( c < 0x80 ) return c;
+        int len = c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+        uint32_t ret = c & ( 0x3F >> len );
+        while( len-- > 0 && ( *ptr & 0xC0 ) == 0x80 ) ret = ( ret << 6 ) | ( *ptr++ & 0x3F );
+        return ret;
+    }
+
+    static std::vector<uint32_t> Build( const LexiconMetaPacket* meta, uint32_t words, const char* str )
+    {
+        std::vector<uint32_t> order( words );
+        std::iota( order.begin(), order.end(), 0 );
+        std::sort( order.begin(), order.end(), [meta, str] ( uint32_t l, uint32_t r ) { return strcmp( str + meta[l].str, str + meta[r].str ) < 0; } );
+
+        std::vector<std::pair<uint32_t, uint32_t>> refs;
+        std::vector<uint32_t> wgrams;
+        std::string padded;
+        for( uint32_t i=0; i<words; i++ )
+        {
+            padded.assign( 1, LexiconGramEdge );
+            padded.append( str + meta[i].str );
+            padded.push_back( LexiconGramEdge );
+            wgrams.clear();
+            for( size_t j=0; j+3<=padded.size(); j++ ) wgrams.emplace_back( Pack( padded.c_str() + j ) );
+            std::sort( wgrams.begin(), wgrams.end() );
+            wgrams.erase( std::unique( wgrams.begin(), wgrams.end() ), wgrams.end() );
+            for( auto& v : wgrams ) refs.emplace_back( v, i );
+        }
+        std::sort( refs.begin(), refs.end() );
+
+        std::vector<LexiconGram> grams;
+        for( uint32_t i=0; i<refs.size(); i++ )
+        {
+            if( grams.empty() || grams.back().gram != refs[i].first ) grams.emplace_back( LexiconGram { refs[i].first, i } );
+        }
+
+        const LexiconDictionaryHeader hdr = { words, uint32_t( grams.size() ), uint32_t( refs.size() ), 0 };
+        std::vector<uint32_t> ret( sizeof( hdr ) / sizeof( uint32_t ) + words + grams.size() * 2 + refs.size() );
+        memcpy( ret.data(), &hdr, sizeof( hdr ) );
+        auto ptr = ret.data() + sizeof( hdr ) / sizeof( uint32_t );
+        ptr = std::copy( order.begin(), order.end(), ptr );
+        memcpy( ptr, grams.data(), grams.size() * sizeof( LexiconGram ) );
+        ptr += grams.size() * 2;
+        for( auto& v : refs ) *ptr++ = v.second;
+        return ret;
+    }
+
+    void Init()
+    {
+        auto ptr = m_local.empty() ? (const uint32_t*)(const char*)m_file : m_local.data();
+        m_hdr = (const LexiconDictionaryHeader*)ptr;
+        m_order = ptr + sizeof( LexiconDictionaryHeader ) / sizeof( uint32_t );
+        m_grams = (const LexiconGram*)( m_order + m_hdr->words );
+        m_refs = (const uint32_t*)( m_grams + m_hdr->grams );
+    }
+
+    // Words containing given trigram.
+    std::pair<const uint32_t*, const uint32_t*> Gram( uint32_t gram ) const
+    {
+        const auto end = m_grams + m_hdr->grams;
+        const auto it = std::lower_bound( m_grams, end, gram, [] ( const LexiconGram& l, uint32_t r ) { return l.gram < r; } );
+        if( it == end || it->gram != gram ) return std::make_pair( m_refs, m_refs );
+        const auto last = it + 1 == end ? m_hdr->refs : it[1].offset;
+        return std::make_pair( m_refs + it->offset, m_refs + last );
+    }
+
+    static bool GlobMatch( const char* pattern, const char* pend, const char* str )
+    {
+        const char* starp = nullptr;
+        const char* stars = nullptr;
+        while( *str )
+        {
+            if( pattern != pend && *pattern == '*' )
+            {
+                starp = ++pattern;
+                stars = str;
+            }
+            else if( pattern != pend && *pattern == *str )
+            {
+                pattern++;
+                str++;
+            }
+            else if( starp )
+            {
+                pattern = starp;
+                str = ++stars;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        while( pattern != pend && *pattern == '*' ) pattern++;
+        return pattern == pend;
+    }
+
+    const FileMap<char> m_file;
+    const FileMap<LexiconMetaPacket> m_meta;
+    const FileMap<char> m_str;
+    std::vector<uint32_t> m_local;
+
+    const LexiconDictionaryHeader* m_hdr;
+    const uint32_t* m_order;
+    const LexiconGram* m_grams;
+    const uint32_t* m_refs;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef __LEXICONPOSTING_HPP__
+#define __LEXICONPOSTING_HPP__
+
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#if defined __SSE2__ || defined _M_X64
+#  define LEXICON_POSTING_SIMD
+#  include <emmintrin.h>
+#endif
+
+#include "FileMap.hpp"
+#include "LexiconTypes.hpp"
+
+// Compressed posting lists, stored in the lexpost file. Holds the same data
+// as lexdata and lexhit, and replaces them in packages. Extracting a package
+// rebuilds them, for tools which read raw postings.
+//   LexiconPostingHeader
+//   uint64_t list[words]                 offset of word's list
+//   lists
+// Number of postings in a list is given by lexmeta. A list is divided into
+// blocks of LexiconBlockSize postings, the last one may be shorter:
+//   LexiconBlockInfo block[blocks]       last postid, data offset and rank bound of each block
+//   block data, each starting at four byte boundary
+// Block data:
+//   uint8_t bits, padding[3]
+//   uint32_t packed[bits*4]              postid deltas, bit-packed in four interleaved lanes, posting i is in lane i%4
+//   uint8_t children[postings]
+//   for each posting: uint8_t hitnum, uint8_t hits[hitnum]
+// Deltas of the first block are relative to zero, other blocks start from
+// the last postid of the previous block. Rank bounds let searches skip
+// blocks which can't reach the best results.
+enum { LexiconBlockSize = 128 };
+
+struct LexiconPostingHeader
+{
+    uint32_t words;
+    uint32_t blockSize;
+};
+
+struct LexiconBlockInfo
+{
+    uint32_t last;      // postid of the last posting in block
+    uint32_t offset;    // block data, relative to list start
+    float max;          // highest LexiconPostingRank * LexiconChildRank of postings in block
+};
+
+static inline uint32_t LexiconBlockCount( uint32_t postings ) { return ( postings + LexiconBlockSize - 1 ) / LexiconBlockSize; }
+
+// Decodes all LexiconBlockSize postids of a block, including padding of a short block.
+static inline void LexiconDecodeBlock( const uint8_t* block, uint32_t base, uint32_t* out )
+{
+    const auto bits = *block;
+    const auto packed = block + 4;
+    assert( bits <= 32 );
+    if( bits == 0 )
+    {
+        std::fill( out, out + LexiconBlockSize, base );
+        return;
+    }
+#ifdef LEXICON_POSTING_SIMD
+    auto in = (const __m128i*)packed;
+    auto cur = _mm_loadu_si128( in++ );
+    const auto mask = _mm_set1_epi32( bits == 32 ? -1 : int( ( 1u << bits ) - 1 ) );
+    uint32_t shift = 0;
+    for( int j=0; j<LexiconBlockSize/4; j++ )
+    {
+        auto v = _mm_srl_epi32( cur, _mm_cvtsi32_si128( shift ) );
+        shift += bits;
+        if( shift >= 32 )
+        {
+            shift -= 32;
+            if( j != LexiconBlockSize/4 - 1 )
+            {
+                cur = _mm_loadu_si128( in++ );
+                if( shift > 0 ) v = _mm_or_si128( v, _mm_sll_epi32( cur, _mm_cvtsi32_si128( bits - shift ) ) );
+            }
+        }
+        _mm_storeu_si128( (__m128i*)( out + j*4 ), _mm_and_si128( v, mask ) );
+    }
+
+    auto prev = _mm_set1_epi32( int( base ) );
+    for( int i=0; i<LexiconBlockSize; i+=4 )
+    {
+        auto v = _mm_loadu_si128( (const __m128i*)( out + i ) );
+        v = _mm_add_epi32( v, _mm_slli_si128( v, 4 ) );
+        v = _mm_add_epi32( v, _mm_slli_si128( v, 8 ) );
+        v = _mm_add_epi32( v, prev );
+        _mm_storeu_si128( (__m128i*)( out + i ), v );
+        prev = _mm_shuffle_epi32( v, 0xFF );
+    }
+#else
+    const uint32_t mask = bits == 32 ? 0xFFFFFFFF : ( 1u << bits ) - 1;
+    for( int lane=0; lane<4; lane++ )
+    {
+        uint32_t word = 0;
+        uint32_t shift = 0;
+        uint32_t cur;
+        memcpy( &cur, packed + lane*4, 4 );
+        for( int j=0; j<LexiconBlockSize/4; j++ )
+        {
+            uint32_t v = cur >> shift;
+            shift += bits;
+            if( shift >= 32 )
+            {
+                shift -= 32;
+                if( j != LexiconBlockSize/4 - 1 )
+                {
+                    word++;
+                    memcpy( &cur, packed + ( word*4 + lane ) * 4, 4 );
+                    if( shift > 0 ) v |= cur << ( bits - shift );
+                }
+            }
+            out[j*4 + lane] = v & mask;
+        }
+    }
+    uint32_t prev = base;
+    for( int i=0; i<LexiconBlockSize; i++ )
+    {
+        prev += out[i];
+        out[i] = prev;
+    }
+#endif
+}
+
+class LexiconPostingView
+{
+public:
+    LexiconPostingView( const std::string& fn )
+        : m_data( fn, true )
+    {
+        Init();
+    }
+
+    LexiconPostingView( const FileMapPtrs& ptrs )
+        : m_data( ptrs )
+    {
+        Init();
+    }
+
+    explicit operator bool() const { return m_hdr != nullptr; }
+
+    // Block directory of word's list. Block data offsets are relative to it.
+    const LexiconBlockInfo* Blocks( uint32_t word ) const
+    {
+        assert( word < m_hdr->words );
+        return (const LexiconBlockInfo*)( m_data + m_list[word] );
+    }
+
+    void Advise( uint32_t access ) const { m_data.Advise( access ); }
+
+    // Converts word's list of size postings back to lexdata packets. Hits which
+    // don't fit in a packet are appended to hits, in lexhit format.
+    void Unpack( uint32_t word, uint32_t size, LexiconDataPacket* data, std::vector<uint8_t>& hits ) const
+    {
+        const auto blocks = Blocks( word );
+        const auto num = LexiconBlockCount( size );
+        uint32_t postid[LexiconBlockSize];
+        for( uint32_t b=0; b<num; b++ )
+        {
+            const auto cnt = std::min<uint32_t>( LexiconBlockSize, size - b * LexiconBlockSize );
+            const auto block = (const uint8_t*)blocks + blocks[b].offset;
+            LexiconDecodeBlock( block, b == 0 ? 0 : blocks[b-1].last, postid );
+            auto children = block + 4 + *block * 16;
+            auto hptr = children + cnt;
+            for( uint32_t i=0; i<cnt; i++ )
+            {
+                const uint8_t hitnum = *hptr++;
+                data->postid = postid[i] | ( uint32_t( children[i] ) << LexiconChildShift );
+                if( hitnum < 4 )
+                {
+                    uint32_t v = 0;
+                    memcpy( &v, hptr, hitnum );
+                    data->hitoffset = v | ( uint32_t( hitnum ) << LexiconHitShift );
+                }
+                else
+                {
+                    data->hitoffset = uint32_t( hits.size() );
+                    hits.emplace_back( hitnum );
+                    hits.insert( hits.end(), hptr, hptr + hitnum );
+                }
+                hptr += hitnum;
+                data++;
+            }
+        }
+    }
+
+private:
+    void Init()
+    {
+        m_hdr = nullptr;
+        if( m_data.Size() < sizeof( LexiconPostingHeader ) ) return;
+        auto hdr = (const LexiconPostingHeader*)(const char*)m_data;
+        if( hdr->blockSize != LexiconBlockSize ) return;
+        m_hdr = hdr;
+        m_list = (const uint64_t*)( m_data + sizeof( LexiconPostingHeader ) );
+    }
+
+    const FileMap<char> m_data;
+    const LexiconPostingHeader* m_hdr;
+    const uint64_t* m_list;
+};
+
+class LexiconPostingWriter
+{
+public:
+    // Data and hits are in lexdata and lexhit format, postings of each word sorted by postid.
+    static void Write( const std::string& base, const LexiconMetaPacket* meta, uint32_t words, const LexiconDataPacket* data, const uint8_t* hits )
+    {
+        FILE* f = fopen( ( base + "lexpost" ).c_str(), "wb" );
+        const LexiconPostingHeader hdr = { words, LexiconBlockSize };
+        fwrite( &hdr, 1, sizeof( hdr ), f );
+
+        std::vector<uint64_t> list( words );
+        uint64_t offset = sizeof( hdr ) + words * sizeof( uint64_t );
+        fwrite( list.data(), 1, words * sizeof( uint64_t ), f );
+
+        std::vector<uint8_t> buf;
+        for( uint32_t w=0; w<words; w++ )
+        {
+            if( ( w & 0x3FFF ) == 0 )
+            {
+                printf( "lexpost %i/%i\r", w, words );
+                fflush( stdout );
+            }
+
+            list[w] = offset;
+            EncodeList( data + meta[w].data / sizeof( LexiconDataPacket ), meta[w].dataSize, hits, buf );
+            offset += fwrite( buf.data(), 1, buf.size(), f );
+        }
+        printf( "\n" );
+
+        fseek( f, sizeof( hdr ), SEEK_SET );
+        fwrite( list.data(), 1, words * sizeof( uint64_t ), f );
+        fclose( f );
+    }
+
+private:
+    static void EncodeList( const LexiconDataPacket* data, uint32_t size, const uint8_t* hits, std::vector<uint8_t>& buf )
+    {
+        const auto blocks = LexiconBlockCount( size );
+        buf.assign( blocks * sizeof( LexiconBlockInfo ), 0 );
+
+        uint32_t prev = 0;
+        for( uint32_t b=0; b<blocks; b++ )
+        {
+            const auto start = b * LexiconBlockSize;
+            const auto num = std::min<uint32_t>( LexiconBlockSize, size - start );
+            const auto post = data + start;
+
+            uint32_t delta[LexiconBlockSize] = {};
+            uint32_t max = 0;
+            for( uint32_t i=0; i<num; i++ )
+            {
+                const auto postid = post[i].postid & LexiconPostMask;
+                assert( postid >= prev );
+                delta[i] = postid - prev;
+                max |= delta[i];
+                prev = postid;
+            }
+            uint8_t bits = 0;
+            while( bits < 32 && ( max >> bits ) != 0 ) bits++;
+
+            buf.resize( ( buf.size() + 3 ) & ~size_t( 3 ) );
+            LexiconBlockInfo info = { prev, uint32_t( buf.size() ), 0 };
+
+            const uint8_t bhdr[4] = { bits, 0, 0, 0 };
+            buf.insert( buf.end(), bhdr, bhdr + 4 );
+
+            std::vector<uint32_t> packed( bits * 4, 0 );
+            for( uint32_t i=0; i<LexiconBlockSize && bits > 0; i++ )
+            {
+                const auto lane = i % 4;
+                const uint64_t bit = uint64_t( i / 4 ) * bits;
+                const auto word = uint32_t( bit / 32 );
+                const auto shift = uint32_t( bit % 32 );
+                packed[word*4 + lane] |= delta[i] << shift;
+                if( shift + bits > 32 ) packed[( word+1 )*4 + lane] |= delta[i] >> ( 32 - shift );
+            }
+            auto ptr = (const uint8_t*)packed.data();
+            buf.insert( buf.end(), ptr, ptr + packed.size() * sizeof( uint32_t ) );
+
+            for( uint32_t i=0; i<num; i++ )
+            {
+                buf.emplace_back( post[i].postid >> LexiconChildShift );
+            }
+            for( uint32_t i=0; i<num; i++ )
+            {
+                uint8_t hitnum = post[i].hitoffset >> LexiconHitShift;
+                const uint8_t* hptr;
+                if( hitnum == 0 )
+                {
+                    hptr = hits + ( post[i].hitoffset & LexiconHitOffsetMask );
+                    hitnum = *hptr++;
+                }
+                else
+                {
+                    hptr = (const uint8_t*)&post[i].hitoffset;
+                }
+                buf.emplace_back( hitnum );
+                buf.insert( buf.end(), hptr, hptr + hitnum );
+                info.max = std::max( info.max, LexiconPostingRank( *hptr, hitnum ) * LexiconChildRank( post[i].postid >> LexiconChildShift ) );
+            }
+            memcpy( buf.data() + b * sizeof( LexiconBlockInfo ), &info, sizeof( info ) );
+        }
+        buf.resize( ( buf.size() + 3 ) & ~size_t( 3 ) );
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define __LEXICONTYPES_HPP__
 
 #include <algorithm>
+#include <limits>
 #include <stdint.h>
 
 enum LexiconType
@@ -99,6 +100,19 @@ static inline float LexiconHitRank( uint8_t v )
     return LexiconWeights[type] * ( pos * 0.9f + 0.1f );
 }
 
+// Query independent rank of a posting: its best hit, ramped up by the number of hits.
+static inline float LexiconPostingRank( uint8_t best, uint8_t hitnum )
+{
+    const float ramp = 1.f + 2.0f * float( hitnum ) / std::numeric_limits<uint8_t>::max();
+    return LexiconHitRank( best ) * ramp;
+}
+
+// Rank modifier of a post, by its (transformed) number of children.
+static inline float LexiconChildRank( uint8_t children )
+{
+    return ( float( children ) / LexiconChildMax ) * 0.75f + 0.25f;
+}
+
 static inline uint8_t LexiconHitPos( uint8_t v )
 {
     auto type = LexiconDecodeType( v );
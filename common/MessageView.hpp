@@ -14,9 +14,9 @@
 class MessageView
 {
 public:
-    MessageView( const std::string& meta, const std::string& data )
-        : m_meta( meta )
-        , m_data( data )
+    MessageView( const std::string& meta, const std::string& data, uint32_t access = FileAccess::Normal )
+        : m_meta( meta, false, access )
+        , m_data( data, false, access )
     {
     }
 
@@ -23,6 +23,8 @@ public:
     {
     }
 
+    void Advise( uint32_t meta, uint32_t data ) const { m_meta.Advise( meta ); m_data.Advise( data ); }
+
     operator const Data*() const { return m_data; }
 
     const Data* operator[]( const size_t idx ) const
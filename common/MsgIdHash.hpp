@@ -40,6 +40,28 @@ static inline int MsgIdHashBits( uint32_t size, uint8_t load )
     return r + 1;
 }
 
+// Hash table layout, stored in the hash metadata file after the maximum probe distance.
+// Files with just the distance byte use the plain layout.
+enum : uint8_t
+{
+    HashLayoutPlain = 0,        // { offset, idx }
+    HashLayoutTagged = 1        // { offset, idx | tag }
+};
+
+// Tagged layout keeps the top bits of the key hash in the top bits of idx,
+// which limits it to tables of at most HashIdxMask+1 entries.
+enum : uint32_t
+{
+    HashTagBits = 8,
+    HashIdxMask = ( 1u << ( 32 - HashTagBits ) ) - 1,
+    HashTagMask = ~HashIdxMask
+};
+
+static inline uint8_t HashLayoutFor( uint32_t size )
+{
+    return size - 1 <= HashIdxMask ? HashLayoutTagged : HashLayoutPlain;
+}
+
 static inline int MsgIdHashSize( int bits )
 {
     return 1 << bits;
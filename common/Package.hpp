@@ -13,17 +13,17 @@ static const PackMeta PackageContents[] = {
     { "name", true },
     { "desc_short", true },
     { "desc_long", true },
-    { "conndata", false },
-    { "connmeta", false },
-    { "lexdata", false },
+    { "conndata", true },
+    { "connmeta", true },
+    { "lexdata", true },
     { "lexmeta", false },
     { "lexhash", false },
     { "lexhashdata", false },
-    { "lexhit", false },
+    { "lexhit", true },
     { "lexstr", false },
     { "middata", false },
     { "midmeta", false },
-    { "midhash", false },
+    { "midhash", true },
     { "midhashdata", false },
     { "strings", false },
     { "strmeta", false },
@@ -34,7 +34,12 @@ static const PackMeta PackageContents[] = {
     { "lexdist", true },
     { "lexdistmeta", true },
     { "prefix", true },
-    { "msgid.codebook", false }
+    { "msgid.codebook", false },
+    { "midphf", true },
+    { "conncol", true },
+    { "timeidx", true },
+    { "lexpost", true },
+    { "lexdict", true }
 };
 
 struct PackageFile
@@ -65,6 +70,11 @@ struct PackageFile
         lexdistmeta,
         prefix,
         codebook,
+        midphf,
+        conncol,
+        timeidx,
+        lexpost,
+        lexdict,
         NUM_PACKAGE_FILE_TYPES
     };
 };
@@ -73,14 +83,64 @@ enum { PackageFiles = sizeof( PackageContents ) / sizeof( PackMeta ) };
 enum { AdditionalFilesV1 = 2 };
 enum { AdditionalFilesV2 = 1 };
 enum { AdditionalFilesV3 = 1 };
+enum { AdditionalFilesV4 = 1 };
+enum { AdditionalFilesV5 = 1 };
+enum { AdditionalFilesV6 = 1 };
+enum { AdditionalFilesV7 = 1 };
+enum { AdditionalFilesV8 = 1 };
+enum { AdditionalFilesV9 = 0 };     // tagged midhash/lexhash slots
 
-enum : char { PackageVersion = 3 };
+enum : char { PackageVersion = 9 };
+enum : char { PackageMinVersion = 3 };      // oldest version libuat can open
 enum { PackageHeaderSize = 8 };
 enum { PackageMagicSize = PackageHeaderSize - 1 };
 static const char PackageHeader[PackageHeaderSize] = { '\0', 'U', 's', 'e', 'n', 'e', 't', PackageVersion };
 
 static inline uint64_t PackageAlign( uint64_t offset ) { return ( ( offset + 7 ) / 8 ) * 8; }
 
+// Number of files stored in package of given version.
+static inline int PackageFilesInVersion( int version )
+{
+    int numfiles = PackageFiles;
+    if( version < 9 )
+    {
+        numfiles -= AdditionalFilesV9;
+        if( version < 8 )
+        {
+            numfiles -= AdditionalFilesV8;
+            if( version < 7 )
+            {
+                numfiles -= AdditionalFilesV7;
+                if( version < 6 )
+                {
+                    numfiles -= AdditionalFilesV6;
+                    if( version < 5 )
+                    {
+                        numfiles -= AdditionalFilesV5;
+                        if( version < 4 )
+                        {
+                            numfiles -= AdditionalFilesV4;
+                            if( version < 3 )
+                            {
+                                numfiles -= AdditionalFilesV3;
+                                if( version < 2 )
+                                {
+                                    numfiles -= AdditionalFilesV2;
+                                    if( version < 1 )
+                                    {
+                                        numfiles -= AdditionalFilesV1;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return numfiles;
+}
+
 
 static_assert( (int)PackageFiles == (int)PackageFile::NUM_PACKAGE_FILE_TYPES, "Package tables mismatch." );
 
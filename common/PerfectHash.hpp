@@ -0,0 +1,251 @@
+#ifndef __PERFECTHASH_HPP__
+#define __PERFECTHASH_HPP__
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "../contrib/xxhash/xxhash.h"
+
+#include "FileMap.hpp"
+
+// Minimal perfect hash over a fixed set of strings, in the spirit of PTHash.
+// Keys are distributed into buckets, each bucket has a pilot value, chosen
+// at build time, which places all keys of the bucket in distinct free slots.
+// Lookup reads one pilot and one slot. Slots past the number of keys (the
+// table is built with a small amount of slack) are remapped to the free
+// slots below it.
+//
+// File layout, each part padded to 8 bytes:
+//   PerfectHashHeader
+//   uint16_t pilot[buckets]
+//   uint32_t remap[tableSize - keys]
+//   Slot slot[keys]
+
+struct PerfectHashHeader
+{
+    uint32_t keys;
+    uint32_t tableSize;
+    uint32_t buckets;
+    uint32_t slotSize;
+    uint64_t seed;
+};
+
+static inline uint64_t PerfectHashMix( uint64_t v )
+{
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ull;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= v >> 33;
+    return v;
+}
+
+static inline uint32_t PerfectHashBucket( uint64_t hash, uint32_t buckets )
+{
+    return uint32_t( ( ( hash >> 32 ) * buckets ) >> 32 );
+}
+
+static inline uint32_t PerfectHashPosition( uint64_t hash, uint16_t pilot, uint32_t tableSize )
+{
+    return uint32_t( PerfectHashMix( hash ^ ( ( pilot + 1ull ) * 0x9e3779b97f4a7c15ull ) ) % tableSize );
+}
+
+static inline uint64_t PerfectHashAlign( uint64_t offset ) { return ( ( offset + 7 ) / 8 ) * 8; }
+
+static inline uint64_t PerfectHashRemapOffset( const PerfectHashHeader& hdr )
+{
+    return PerfectHashAlign( sizeof( PerfectHashHeader ) + hdr.buckets * sizeof( uint16_t ) );
+}
+
+static inline uint64_t PerfectHashSlotOffset( const PerfectHashHeader& hdr )
+{
+    return PerfectHashAlign( PerfectHashRemapOffset( hdr ) + ( hdr.tableSize - hdr.keys ) * sizeof( uint32_t ) );
+}
+
+template<class Slot>
+class PerfectHash
+{
+public:
+    PerfectHash( const std::string& fn )
+        : m_data( fn, true, FileAccess::Random )
+    {
+        Init();
+    }
+
+    PerfectHash( const FileMapPtrs& ptrs )
+        : m_data( ptrs, FileAccess::Random )
+    {
+        Init();
+    }
+
+    explicit operator bool() const { return m_hdr != nullptr; }
+
+    // Returns the only slot the string can be in. Caller has to verify the key.
+    const Slot* Find( const char* str, size_t len ) const
+    {
+        if( m_hdr->keys == 0 ) return nullptr;
+        const auto hash = XXH64( str, len, m_hdr->seed );
+        const auto bucket = PerfectHashBucket( hash, m_hdr->buckets );
+        auto pos = PerfectHashPosition( hash, m_pilot[bucket], m_hdr->tableSize );
+        if( pos >= m_hdr->keys ) pos = m_remap[pos - m_hdr->keys];
+        return m_slot + pos;
+    }
+
+private:
+    void Init()
+    {
+        m_hdr = nullptr;
+        if( m_data.Size() < sizeof( PerfectHashHeader ) ) return;
+        auto hdr = (const PerfectHashHeader*)(const char*)m_data;
+        if( hdr->slotSize != sizeof( Slot ) ) return;
+        if( m_data.Size() < PerfectHashSlotOffset( *hdr ) + uint64_t( hdr->keys ) * sizeof( Slot ) ) return;
+        m_hdr = hdr;
+        m_pilot = (const uint16_t*)( m_data + sizeof( PerfectHashHeader ) );
+        m_remap = (const uint32_t*)( m_data + PerfectHashRemapOffset( *hdr ) );
+        m_slot = (const Slot*)( m_data + PerfectHashSlotOffset( *hdr ) );
+    }
+
+    FileMap<char> m_data;
+    const PerfectHashHeader* m_hdr;
+    const uint16_t* m_pilot;
+    const uint32_t* m_remap;
+    const Slot* m_slot;
+};
+
+class PerfectHashBuilder
+{
+    enum { BucketLoad = 4 };        // average keys per bucket
+    enum { Slack = 100 };           // one extra table slot per this many keys
+
+public:
+    // Returns false if keys are not unique, or if no perfect hash could be found.
+    bool Build( const char* const* keys, uint32_t num )
+    {
+        m_hdr.keys = num;
+        m_hdr.tableSize = num + num / Slack + 1;
+        m_hdr.buckets = std::max<uint32_t>( 1, ( num + BucketLoad - 1 ) / BucketLoad );
+
+        std::vector<uint64_t> hash( num );
+        for( uint64_t seed=0; seed<16; seed++ )
+        {
+            m_hdr.seed = seed * 0x9e3779b97f4a7c15ull;
+            for( uint32_t i=0; i<num; i++ )
+            {
+                hash[i] = XXH64( keys[i], strlen( keys[i] ), m_hdr.seed );
+            }
+
+            std::vector<uint32_t> sorted( num );
+            for( uint32_t i=0; i<num; i++ ) sorted[i] = i;
+            std::sort( sorted.begin(), sorted.end(), [&hash] ( const auto& l, const auto& r ) { return hash[l] < hash[r]; } );
+            bool collision = false;
+            for( uint32_t i=1; i<num; i++ )
+            {
+                if( hash[sorted[i-1]] == hash[sorted[i]] )
+                {
+                    if( strcmp( keys[sorted[i-1]], keys[sorted[i]] ) == 0 ) return false;
+                    collision = true;
+                }
+            }
+            if( !collision && TryBuild( hash ) ) return true;
+        }
+        return false;
+    }
+
+    // Position of i-th key in the slot array.
+    uint32_t Position( uint32_t i ) const { return m_position[i]; }
+
+    // Slots must be ordered by position.
+    void Write( FILE* f, const void* slots, uint32_t slotSize )
+    {
+        const uint64_t zero = 0;
+        m_hdr.slotSize = slotSize;
+        uint64_t offset = fwrite( &m_hdr, 1, sizeof( m_hdr ), f );
+        offset += fwrite( m_pilot.data(), 1, m_pilot.size() * sizeof( uint16_t ), f );
+        offset += fwrite( &zero, 1, PerfectHashRemapOffset( m_hdr ) - offset, f );
+        offset += fwrite( m_remap.data(), 1, m_remap.size() * sizeof( uint32_t ), f );
+        offset += fwrite( &zero, 1, PerfectHashSlotOffset( m_hdr ) - offset, f );
+        fwrite( slots, 1, uint64_t( slotSize ) * m_hdr.keys, f );
+    }
+
+private:
+    bool TryBuild( const std::vector<uint64_t>& hash )
+    {
+        const auto num = m_hdr.keys;
+        const auto buckets = m_hdr.buckets;
+        const auto tableSize = m_hdr.tableSize;
+
+        std::vector<uint32_t> start( buckets + 1, 0 );
+        for( uint32_t i=0; i<num; i++ ) start[PerfectHashBucket( hash[i], buckets ) + 1]++;
+        for( uint32_t i=0; i<buckets; i++ ) start[i+1] += start[i];
+        std::vector<uint32_t> member( num );
+        {
+            auto fill = start;
+            for( uint32_t i=0; i<num; i++ ) member[fill[PerfectHashBucket( hash[i], buckets )]++] = i;
+        }
+
+        std::vector<uint32_t> order( buckets );
+        for( uint32_t i=0; i<buckets; i++ ) order[i] = i;
+        std::stable_sort( order.begin(), order.end(), [&start] ( const auto& l, const auto& r ) { return start[l+1] - start[l] > start[r+1] - start[r]; } );
+
+        m_pilot.assign( buckets, 0 );
+        m_position.resize( num );
+        std::vector<uint8_t> taken( tableSize, 0 );
+        std::vector<uint32_t> pos;
+        for( auto b : order )
+        {
+            const auto size = start[b+1] - start[b];
+            if( size == 0 ) break;
+            bool found = false;
+            for( uint32_t pilot=0; pilot<=0xFFFF && !found; pilot++ )
+            {
+                pos.clear();
+                found = true;
+                for( uint32_t j=start[b]; j<start[b+1]; j++ )
+                {
+                    const auto p = PerfectHashPosition( hash[member[j]], pilot, tableSize );
+                    if( taken[p] || std::find( pos.begin(), pos.end(), p ) != pos.end() )
+                    {
+                        found = false;
+                        break;
+                    }
+                    pos.emplace_back( p );
+                }
+                if( found )
+                {
+                    m_pilot[b] = pilot;
+                    for( uint32_t j=0; j<size; j++ )
+                    {
+                        taken[pos[j]] = 1;
+                        m_position[member[start[b]+j]] = pos[j];
+                    }
+                }
+            }
+            if( !found ) return false;
+        }
+
+        // Map slots past the end of key range into holes left below it.
+        m_remap.assign( tableSize - num, 0 );
+        uint32_t hole = 0;
+        for( uint32_t p=num; p<tableSize; p++ )
+        {
+            if( !taken[p] ) continue;
+            while( taken[hole] ) hole++;
+            m_remap[p - num] = hole++;
+        }
+        for( auto& v : m_position )
+        {
+            if( v >= num ) v = m_remap[v - num];
+        }
+        return true;
+    }
+
+    PerfectHashHeader m_hdr;
+    std::vector<uint16_t> m_pilot;
+    std::vector<uint32_t> m_remap;
+    std::vector<uint32_t> m_position;
+};
+
+#endif
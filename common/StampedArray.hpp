@@ -0,0 +1,50 @@
+#ifndef __STAMPEDARRAY_HPP__
+#define __STAMPEDARRAY_HPP__
+
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+// Sparse array which can be cleared in constant time. Each entry carries the
+// generation in which it was set, entries from older generations read as
+// absent. Stamps are wiped only when the generation counter wraps around.
+// Storage only grows, so reusing one array for many passes doesn't allocate.
+template<class T>
+class StampedArray
+{
+public:
+    StampedArray() : m_generation( 0 ) {}
+
+    // Starts a new pass over indices in [0, size). All entries become absent.
+    void Reset( size_t size )
+    {
+        if( m_stamp.size() < size )
+        {
+            m_stamp.resize( size, 0 );
+            m_value.resize( size );
+        }
+        if( ++m_generation == 0 )
+        {
+            std::fill( m_stamp.begin(), m_stamp.end(), 0 );
+            m_generation = 1;
+        }
+    }
+
+    bool Has( size_t idx ) const { assert( idx < m_stamp.size() ); return m_stamp[idx] == m_generation; }
+    const T& operator[]( size_t idx ) const { assert( Has( idx ) ); return m_value[idx]; }
+
+    void Set( size_t idx, const T& value )
+    {
+        assert( idx < m_stamp.size() );
+        m_stamp[idx] = m_generation;
+        m_value[idx] = value;
+    }
+
+private:
+    std::vector<uint32_t> m_stamp;
+    std::vector<T> m_value;
+    uint32_t m_generation;
+};
+
+#endif
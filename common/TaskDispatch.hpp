@@ -20,6 +20,9 @@ public:
 
     void Sync();
 
+    // Threads running queued jobs, including the one calling Sync().
+    size_t NumberOfWorkers() const { return m_workers.size() + 1; }
+
 private:
     void Worker();
 
@@ -0,0 +1,201 @@
+#ifndef __TIMEINDEX_HPP__
+#define __TIMEINDEX_HPP__
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include "Connectivity.hpp"
+#include "FileMap.hpp"
+#include "Filesystem.hpp"
+
+// Messages ordered by date, stored in the timeidx file:
+//   TimeIndexHeader
+//   uint32_t order[messages]           message indices, sorted by date
+//   uint32_t date[messages]            date of order[i]
+//   uint32_t dayOffset[days+1]         messages posted on firstDay+d are at [dayOffset[d], dayOffset[d+1])
+// Messages without a date (epoch 0) are not indexed.
+struct TimeIndexHeader
+{
+    uint32_t messages;
+    uint32_t firstDay;
+    uint32_t days;
+    uint32_t reserved;
+};
+
+struct TimeGranularity
+{
+    enum type
+    {
+        Day,
+        Month,
+        Year
+    };
+};
+
+struct TimeBucket
+{
+    uint32_t start;     // epoch of bucket start
+    uint32_t count;
+};
+
+class TimeIndex
+{
+    enum { SecondsPerDay = 60 * 60 * 24 };
+
+public:
+    // Maps timeidx. Older archives don't have it, the index is then built from thread structure.
+    TimeIndex( const std::string& base )
+        : m_file( base + "timeidx", true )
+    {
+        if( m_file.Size() < sizeof( TimeIndexHeader ) ) m_local = Build( ConnectivityView( base ) );
+        Init();
+    }
+
+    TimeIndex( const FileMapPtrs& idx, const FileMapPtrs& col, const FileMapPtrs& meta, const FileMapPtrs& data )
+        : m_file( idx )
+    {
+        if( m_file.Size() < sizeof( TimeIndexHeader ) ) m_local = Build( ConnectivityView( col, meta, data ) );
+        Init();
+    }
+
+    size_t Size() const { return m_hdr->messages; }
+    uint32_t First() const { return Size() == 0 ? 0 : m_date[0]; }
+    uint32_t Last() const { return Size() == 0 ? 0 : m_date[Size()-1]; }
+
+    // Messages dated in [from, to), as a range of the order array.
+    std::pair<const uint32_t*, const uint32_t*> Range( uint32_t from, uint32_t to ) const
+    {
+        const auto lo = Lower( from );
+        const auto hi = std::max( lo, Lower( to ) );
+        return std::make_pair( m_order + lo, m_order + hi );
+    }
+
+    std::vector<TimeBucket> Histogram( TimeGranularity::type granularity ) const
+    {
+        std::vector<TimeBucket> ret;
+        for( uint32_t d=0; d<m_hdr->days; d++ )
+        {
+            const auto cnt = m_dayOffset[d+1] - m_dayOffset[d];
+            if( cnt == 0 ) continue;
+            const auto start = BucketStart( m_hdr->firstDay + d, granularity );
+            if( ret.empty() || ret.back().start != start )
+            {
+                ret.emplace_back( TimeBucket { start, cnt } );
+            }
+            else
+            {
+                ret.back().count += cnt;
+            }
+        }
+        return ret;
+    }
+
+    static void Write( const std::string& base, const ConnectivityView& conn )
+    {
+        const auto data = Build( conn );
+        FILE* f = fopen( ( base + "timeidx" ).c_str(), "wb" );
+        fwrite( data.data(), 1, data.size() * sizeof( uint32_t ), f );
+        fclose( f );
+    }
+
+private:
+    static std::vector<uint32_t> Build( const ConnectivityView& conn )
+    {
+        const auto size = conn.Size();
+        std::vector<uint32_t> order;
+        order.reserve( size );
+        for( uint32_t i=0; i<size; i++ )
+        {
+            if( conn.Date( i ) != 0 ) order.emplace_back( i );
+        }
+        std::stable_sort( order.begin(), order.end(), [&conn] ( const auto& l, const auto& r ) { return conn.Date( l ) < conn.Date( r ); } );
+
+        TimeIndexHeader hdr = { uint32_t( order.size() ), 0, 0, 0 };
+        if( !order.empty() )
+        {
+            hdr.firstDay = conn.Date( order.front() ) / SecondsPerDay;
+            hdr.days = conn.Date( order.back() ) / SecondsPerDay - hdr.firstDay + 1;
+        }
+
+        std::vector<uint32_t> ret( sizeof( hdr ) / sizeof( uint32_t ) + order.size() * 2 + hdr.days + 1 );
+        memcpy( ret.data(), &hdr, sizeof( hdr ) );
+        auto ptr = ret.data() + sizeof( hdr ) / sizeof( uint32_t );
+        ptr = std::copy( order.begin(), order.end(), ptr );
+        for( auto& v : order ) *ptr++ = conn.Date( v );
+        uint32_t day = 0;
+        for( uint32_t i=0; i<order.size(); i++ )
+        {
+            const auto d = conn.Date( order[i] ) / SecondsPerDay - hdr.firstDay;
+            while( day <= d ) ptr[day++] = i;
+        }
+        while( day <= hdr.days ) ptr[day++] = hdr.messages;
+        return ret;
+    }
+
+    void Init()
+    {
+        auto ptr = m_local.empty() ? (const uint32_t*)(const char*)m_file : m_local.data();
+        m_hdr = (const TimeIndexHeader*)ptr;
+        m_order = ptr + sizeof( TimeIndexHeader ) / sizeof( uint32_t );
+        m_date = m_order + m_hdr->messages;
+        m_dayOffset = m_date + m_hdr->messages;
+    }
+
+    // Index of first message dated at or after t.
+    uint32_t Lower( uint32_t t ) const
+    {
+        const auto day = t / SecondsPerDay;
+        if( day < m_hdr->firstDay ) return 0;
+        if( day - m_hdr->firstDay >= m_hdr->days ) return m_hdr->messages;
+        const auto d = day - m_hdr->firstDay;
+        return std::lower_bound( m_date + m_dayOffset[d], m_date + m_dayOffset[d+1], t ) - m_date;
+    }
+
+    // Days since epoch to civil date, see http://howardhinnant.github.io/date_algorithms.html
+    static void CivilFromDays( int32_t z, int32_t& y, uint32_t& m )
+    {
+        z += 719468;
+        const int32_t era = ( z >= 0 ? z : z - 146096 ) / 146097;
+        const uint32_t doe = z - era * 146097;
+        const uint32_t yoe = ( doe - doe/1460 + doe/36524 - doe/146096 ) / 365;
+        const uint32_t doy = doe - ( 365*yoe + yoe/4 - yoe/100 );
+        const uint32_t mp = ( 5*doy + 2 ) / 153;
+        m = mp < 10 ? mp + 3 : mp - 9;
+        y = int32_t( yoe ) + era * 400 + ( m <= 2 );
+    }
+
+    static int32_t DaysFromCivil( int32_t y, uint32_t m, uint32_t d )
+    {
+        y -= m <= 2;
+        const int32_t era = ( y >= 0 ? y : y - 399 ) / 400;
+        const uint32_t yoe = uint32_t( y - era * 400 );
+        const uint32_t doy = ( 153 * ( m > 2 ? m-3 : m+9 ) + 2 ) / 5 + d - 1;
+        const uint32_t doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+        return era * 146097 + int32_t( doe ) - 719468;
+    }
+
+    static uint32_t BucketStart( uint32_t day, TimeGranularity::type granularity )
+    {
+        if( granularity == TimeGranularity::Day ) return day * SecondsPerDay;
+        int32_t y;
+        uint32_t m;
+        CivilFromDays( day, y, m );
+        if( granularity == TimeGranularity::Year ) m = 1;
+        return uint32_t( DaysFromCivil( y, m, 1 ) ) * SecondsPerDay;
+    }
+
+    const FileMap<char> m_file;
+    std::vector<uint32_t> m_local;
+
+    const TimeIndexHeader* m_hdr;
+    const uint32_t* m_order;
+    const uint32_t* m_date;
+    const uint32_t* m_dayOffset;
+};
+
+#endif
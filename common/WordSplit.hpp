@@ -0,0 +1,76 @@
+#ifndef __WORDSPLIT_HPP__
+#define __WORDSPLIT_HPP__
+
+#include <stdint.h>
+
+#include "LexiconTypes.hpp"
+
+// Word splitting rules of lexicon. Anything that has to find the words
+// lexicon indexed in a text must split it the same way.
+
+static inline bool WordIsAlpha( char c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' );
+}
+
+static inline bool WordIsDigit( char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool WordIsAlnum( char c )
+{
+    return WordIsAlpha( c ) || WordIsDigit( c );
+}
+
+// Calls f( ptr, len ) for each word of ASCII text, in order.
+template<class F>
+static inline void SplitASCIIWords( const char* ptr, const char* end, F&& f )
+{
+    for(;;)
+    {
+        while( ptr < end && !WordIsAlnum( *ptr ) ) ptr++;
+        if( ptr >= end ) return;
+        auto e = ptr+1;
+        while( e < end && ( WordIsAlnum( *e ) || *e == '_' || ( e < end-1 && (
+            ( WordIsAlpha( e[-1] ) && WordIsAlpha( e[1] ) && ( *e == ':' || *e == '.' || *e == '\'' ) ) ||
+            ( WordIsDigit( e[-1] ) && WordIsDigit( e[1] ) && ( *e == ',' || *e == '.' || *e == '\'' || *e == ';' ) )
+            ) ) ) ) e++;
+        while( e > ptr+2 && e[-1] == '_' ) e--;
+        const auto len = e - ptr;
+        if( len >= LexiconMinLen && len <= LexiconMaxLen ) f( ptr, uint32_t( len ) );
+        if( e >= end ) return;
+        ptr = e+1;
+    }
+}
+
+// Splits a line into the runs which lexicon splits into words by different
+// means. Space or tab delimited runs holding UTF-8 sequences are passed to
+// utf( begin, end ), the ASCII text between them to ascii( begin, end ).
+// Neither range is ever empty.
+template<class A, class U>
+static inline void SplitTextRuns( const char* ptr, const char* end, A&& ascii, U&& utf )
+{
+    while( ptr <= end )
+    {
+        auto putf = ptr;
+        while( putf < end && ( *putf & 0x80 ) == 0 ) putf++;
+        if( putf == end )
+        {
+            if( ptr != end ) ascii( ptr, end );
+            return;
+        }
+        auto split = putf;
+        while( split > ptr && *split != ' ' && *split != '\t' ) split--;
+        if( split > ptr )
+        {
+            ascii( ptr, split );
+            ptr = split+1;
+        }
+        while( putf < end && *putf != ' ' && *putf != '\t' ) putf++;
+        utf( ptr, putf );
+        ptr = putf + 1;
+    }
+}
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef __ZMESSAGEVIEW_HPP__
 #define __ZMESSAGEVIEW_HPP__
 
+#include <algorithm>
 #include <assert.h>
+#include <mutex>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string>
 
@@ -12,14 +15,17 @@
 #include "FileMap.hpp"
 #include "RawImportMeta.hpp"
 
+// Message retrieval is thread safe. The dictionary is built once, on first
+// use, and is then shared read-only by all threads. Each calling thread
+// decompresses with its own context, so no external locking is required.
 class ZMessageView
 {
 public:
-    ZMessageView( const std::string& meta, const std::string& data, const std::string& dict )
-        : m_meta( meta )
-        , m_data( data )
+    ZMessageView( const std::string& meta, const std::string& data, const std::string& dict, uint32_t access = FileAccess::Normal )
+        : m_meta( meta, false, access )
+        , m_data( data, false, access )
         , m_dictdata( dict )
-        , m_ctx( nullptr )
+        , m_dict( nullptr )
     {
     }
 
@@ -27,31 +33,121 @@ public:
         : m_meta( meta )
         , m_data( data )
         , m_dictdata( dict )
-        , m_ctx( nullptr )
+        , m_dict( nullptr )
     {
     }
 
     ~ZMessageView()
     {
-        if( m_ctx )
-        {
-            ZSTD_freeDCtx( m_ctx );
-            ZSTD_freeDDict( m_dict );
-        }
+        if( m_dict ) ZSTD_freeDDict( m_dict );
     }
 
-    const char* GetMessage( const size_t idx, ExpandingBuffer& eb )
+    ZMessageView( const ZMessageView& ) = delete;
+    ZMessageView& operator=( const ZMessageView& ) = delete;
+
+    const char* GetMessage( const size_t idx, ExpandingBuffer& eb ) const
     {
-        if( !m_ctx ) InitZstd();
-        assert( idx < m_meta.Size() );
+        std::call_once( m_dictInit, [this] { m_dict = ZSTD_createDDict_byReference( m_dictdata, m_dictdata.Size() ); } );
+        assert( idx < Size() );
         const auto meta = m_meta[idx];
         auto buf = eb.Request( meta.size + 1 );
-        const auto dec = ZSTD_decompress_usingDDict( m_ctx, buf, meta.size, m_data + meta.offset, meta.compressedSize, m_dict );
+        const auto dec = ZSTD_decompress_usingDDict( GetThreadContext(), buf, meta.size, m_data + meta.offset, meta.compressedSize, m_dict );
         assert( dec == meta.size );
         buf[meta.size] = '\0';
         return buf;
     }
 
+    enum : size_t { NoLimit = SIZE_MAX };
+
+    // Decodes only the beginning of a message: at most maxBytes, and no more
+    // than bodyLines lines past the empty line ending the headers (zero stops
+    // right after it). Returned text is null terminated. The number of
+    // message bytes which were not decoded is stored in skipped. Streaming
+    // decompression can only stop at zstd block boundaries, so work is saved
+    // on messages spanning many blocks, like large binaries.
+    const char* GetMessagePart( const size_t idx, ExpandingBuffer& eb, size_t maxBytes, size_t bodyLines, size_t& skipped ) const
+    {
+        enum { Step = 4 * 1024 };
+
+        std::call_once( m_dictInit, [this] { m_dict = ZSTD_createDDict_byReference( m_dictdata, m_dictdata.Size() ); } );
+        assert( idx < Size() );
+        const auto meta = m_meta[idx];
+        const auto limit = std::min<size_t>( meta.size, maxBytes );
+        auto buf = eb.Request( limit + 1 );
+
+        auto ctx = GetThreadContext();
+        ZSTD_DCtx_refDDict( ctx, m_dict );
+        ZSTD_inBuffer in = { m_data + meta.offset, meta.compressedSize, 0 };
+        ZSTD_outBuffer out = { buf, 0, 0 };
+
+        size_t end = 0;
+        size_t lines = 0;
+        bool body = false;
+        bool done = false;
+        while( !done && out.pos < limit )
+        {
+            out.size = std::min<size_t>( limit, out.pos + Step );
+            const auto inPos = in.pos;
+            const auto outPos = out.pos;
+            const auto ret = ZSTD_decompressStream( ctx, &out, &in );
+            if( ZSTD_isError( ret ) ) break;
+            for( ; end < out.pos; end++ )
+            {
+                if( buf[end] != '\n' ) continue;
+                if( !body )
+                {
+                    if( end != 0 && buf[end-1] != '\n' ) continue;
+                    body = true;
+                    done = bodyLines == 0;
+                }
+                else
+                {
+                    done = ++lines == bodyLines;
+                }
+                if( done )
+                {
+                    end++;
+                    break;
+                }
+            }
+            if( ret == 0 ) break;
+            // Truncated or corrupt data may leave the decoder without anything to do.
+            if( in.pos == inPos && out.pos == outPos ) break;
+        }
+        ZSTD_DCtx_reset( ctx, ZSTD_reset_session_and_parameters );
+
+        if( !done ) end = out.pos;
+        buf[end] = '\0';
+        skipped = meta.size - end;
+        return buf;
+    }
+
+    // Indices must be sorted by data offset. Ranges lying close to each
+    // other are merged, to issue a small number of large read requests.
+    void Prefetch( const uint32_t* idx, size_t num ) const
+    {
+        enum { MergeDistance = 64 * 1024 };
+
+        if( num == 0 ) return;
+        auto meta = m_meta[idx[0]];
+        uint64_t begin = meta.offset;
+        uint64_t end = begin + meta.compressedSize;
+        for( size_t i=1; i<num; i++ )
+        {
+            meta = m_meta[idx[i]];
+            assert( meta.offset >= begin );
+            if( meta.offset > end + MergeDistance )
+            {
+                m_data.Prefetch( begin, end - begin );
+                begin = meta.offset;
+            }
+            end = std::max<uint64_t>( end, meta.offset + meta.compressedSize );
+        }
+        m_data.Prefetch( begin, end - begin );
+    }
+
+    void Advise( uint32_t meta, uint32_t data ) const { m_meta.Advise( meta ); m_data.Advise( data ); }
+
     struct RawMessage
     {
         const char* ptr;
@@ -83,19 +179,26 @@ public:
     }
 
 private:
-    void InitZstd()
+    // Decompression contexts are not bound to any dictionary, so a single
+    // context per thread is shared by all views used on that thread.
+    static ZSTD_DCtx* GetThreadContext()
     {
-        assert( !m_ctx );
-        m_ctx = ZSTD_createDCtx();
-        m_dict = ZSTD_createDDict_byReference( m_dictdata, m_dictdata.Size() );
+        struct Context
+        {
+            Context() : ctx( ZSTD_createDCtx() ) {}
+            ~Context() { ZSTD_freeDCtx( ctx ); }
+            ZSTD_DCtx* ctx;
+        };
+        static thread_local Context context;
+        return context.ctx;
     }
 
     const FileMap<RawImportMeta> m_meta;
     const FileMap<char> m_data;
     const FileMap<char> m_dictdata;
 
-    ZSTD_DCtx* m_ctx;
-    ZSTD_DDict* m_dict;
+    mutable std::once_flag m_dictInit;
+    mutable ZSTD_DDict* m_dict;
 };
 
 #endif
@@ -35,4 +35,14 @@ int munmap( void* addr, size_t length )
     return UnmapViewOfFile( addr ) != 0 ? 0 : -1;
 }
 
+int madvise( void* addr, size_t length, int advice )
+{
+    return 0;
+}
+
+int mlock( const void* addr, size_t length )
+{
+    return VirtualLock( (LPVOID)addr, length ) ? 0 : -1;
+}
+
 #endif
@@ -3,6 +3,18 @@
 
 #if !defined _MSC_VER && !defined __MINGW32__ && !defined __CYGWIN__
 #  include <sys/mman.h>
+#  include <unistd.h>
+
+#  ifndef MAP_POPULATE
+#    define MAP_POPULATE 0
+#  endif
+
+static inline size_t PageSize()
+{
+    static const size_t size = sysconf( _SC_PAGESIZE );
+    return size;
+}
+
 #else
 #  include <string.h>
 #  include <sys/types.h>
@@ -10,9 +22,19 @@
 #  define PROT_READ 1
 #  define PROT_WRITE 2
 #  define MAP_SHARED 0
+#  define MAP_POPULATE 0
+
+#  define MADV_NORMAL 0
+#  define MADV_RANDOM 1
+#  define MADV_SEQUENTIAL 2
+#  define MADV_WILLNEED 3
 
 void* mmap( void* addr, size_t length, int prot, int flags, int fd, off_t offset );
 int munmap( void* addr, size_t length );
+int madvise( void* addr, size_t length, int advice );
+int mlock( const void* addr, size_t length );
+
+static inline size_t PageSize() { return 4096; }
 
 #endif
 
@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "../contrib/martinus/robin_hood.h"
+#include "../common/Connectivity.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/HashSearch.hpp"
 #include "../common/MessageLogic.hpp"
@@ -18,6 +19,7 @@
 #include "../common/ReferencesParent.hpp"
 #include "../common/String.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/TimeIndex.hpp"
 
 enum { TimeTravelLimit = 60*60*24*7 };      // one week
 
@@ -58,8 +60,8 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
-    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata" );
+    MessageView mview( base + "meta", base + "data", FileAccess::Sequential );
+    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata", base + "midphf" );
     const StringCompress compress( base + "msgid.codebook" );
 
     const auto size = mview.Size();
@@ -366,9 +368,7 @@ int main( int argc, char** argv )
     fwrite( toplevel.data(), 1, sizeof( uint32_t ) * toplevel.size(), tlout );
     fclose( tlout );
 
-    FILE* cdata = fopen( ( base + "conndata" ).c_str(), "wb" );
-    FILE* cmeta = fopen( ( base + "connmeta" ).c_str(), "wb" );
-    uint32_t offset = 0;
+    ConnectivityWriter conn( size );
     for( uint32_t i=0; i<size; i++ )
     {
         if( ( i & 0x1FFF ) == 0 )
@@ -377,23 +377,15 @@ int main( int argc, char** argv )
             fflush( stdout );
         }
 
-        fwrite( &offset, 1, sizeof( uint32_t ), cmeta );
-
-        offset += fwrite( &data[i].epoch, 1, sizeof( Message::epoch ), cdata );
-        offset += fwrite( &data[i].parent, 1, sizeof( Message::parent ), cdata );
-        offset += fwrite( &data[i].childTotal, 1, sizeof( Message::childTotal ), cdata );
-        uint32_t cnum = data[i].children.size();
-        offset += fwrite( &cnum, 1, sizeof( cnum ), cdata );
-        for( auto& v : data[i].children )
-        {
-            offset += fwrite( &v, 1, sizeof( v ), cdata );
-        }
+        conn.Add( data[i].epoch, data[i].parent, data[i].childTotal, data[i].children.data(), data[i].children.size() );
     }
-    fclose( cdata );
-    fclose( cmeta );
+    conn.Write( base );
 
     printf( "%i/%i\n", size, size );
 
+    printf( "Building time index...\n" );
+    TimeIndex::Write( base, ConnectivityView( base ) );
+
     delete[] data;
     return 0;
 }
@@ -18,6 +18,7 @@
 #include "../common/MessageLogic.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/MsgIdHash.hpp"
+#include "../common/PerfectHash.hpp"
 #include "../common/Slab.hpp"
 #include "../common/String.hpp"
 #include "../common/StringCompress.hpp"
@@ -48,7 +49,7 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
+    MessageView mview( base + "meta", base + "data", FileAccess::Sequential );
     const auto size = mview.Size();
 
     std::vector<const char*> rawmsgidvec;
@@ -174,8 +175,10 @@ int main( int argc, char** argv )
         }
     }
 
+    const uint8_t layout = HashLayoutFor( size );
     FILE* meta = fopen( ( base + "midhashdata" ).c_str(), "wb" );
     fwrite( &distmax, 1, 1, meta );
+    fwrite( &layout, 1, 1, meta );
     fclose( meta );
 
     FILE* data = fopen( ( base + "midhash" ).c_str(), "wb" );
@@ -203,13 +206,18 @@ int main( int argc, char** argv )
         }
         else
         {
+            auto str = msgidvec[hashdata[i]];
+            const auto len = strlen( (const char*)str );
+            const uint32_t hash = XXH32( str, len, 0 );
+
+            const uint32_t idx = layout == HashLayoutTagged ? ( hashdata[i] | ( hash & HashTagMask ) ) : hashdata[i];
+
             fwrite( &stroffset, 1, sizeof( uint32_t ), data );
-            fwrite( hashdata+i, 1, sizeof( uint32_t ), data );
+            fwrite( &idx, 1, sizeof( uint32_t ), data );
 
             msgidoffset[hashdata[i]] = stroffset;
             cnt++;
-            auto str = msgidvec[hashdata[i]];
-            stroffset += fwrite( str, 1, strlen( (const char*)str ) + 1, strdata );
+            stroffset += fwrite( str, 1, len + 1, strdata );
         }
     }
 
@@ -222,5 +230,31 @@ int main( int argc, char** argv )
 
     printf( "%i/%i\n", hashsize, hashsize );
 
+    printf( "Building perfect hash...\n" );
+    fflush( stdout );
+    std::vector<const char*> keys;
+    keys.reserve( size );
+    for( auto& v : msgidvec ) keys.emplace_back( (const char*)v );
+    PerfectHashBuilder phf;
+    if( phf.Build( keys.data(), size ) )
+    {
+        auto slots = new uint32_t[size*2];
+        for( uint32_t i=0; i<size; i++ )
+        {
+            const auto pos = phf.Position( i );
+            slots[pos*2] = msgidoffset[i];
+            slots[pos*2+1] = i;
+        }
+        FILE* fphf = fopen( ( base + "midphf" ).c_str(), "wb" );
+        phf.Write( fphf, slots, sizeof( uint32_t ) * 2 );
+        fclose( fphf );
+        delete[] slots;
+    }
+    else
+    {
+        fprintf( stderr, "Cannot build perfect hash, message ids are not unique.\n" );
+        remove( ( base + "midphf" ).c_str() );
+    }
+
     return 0;
 }
@@ -36,7 +36,7 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
+    MessageView mview( base + "meta", base + "data", FileAccess::Sequential );
     const auto size = mview.Size();
 
     std::vector<std::string> strings;
@@ -9,10 +9,10 @@
 #include <sys/stat.h>
 #include <vector>
 
+#include "../common/Connectivity.hpp"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
-#include "../common/MetaView.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/RawImportMeta.hpp"
 #include "../common/String.hpp"
@@ -41,7 +41,7 @@ int main( int argc, char** argv )
     MessageView mview( base + "meta", base + "data" );
     const auto size = mview.Size();
 
-    const MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    const ConnectivityView conn( base );
 
     CreateDirStruct( argv[3] );
 
@@ -67,7 +67,7 @@ int main( int argc, char** argv )
             fflush( stdout );
         }
 
-        auto date = *conn[i];
+        auto date = conn.Date( i );
         const auto raw = mview.Raw( i );
 
         if( date == 0 )
@@ -16,6 +16,7 @@
 #include "../contrib/terminator/terminator.h"
 #include "../contrib/martinus/robin_hood.h"
 
+#include "../common/Connectivity.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
 #include "../common/HashSearch.hpp"
@@ -110,9 +111,9 @@ int main( int argc, char** argv )
     const FileMap<uint32_t> toplevel( base + "toplevel" );
     auto topsize = toplevel.DataSize();
     const MetaView<uint32_t, char> strings( base + "strmeta", base + "strings" );
-    const MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    const ConnectivityView conn( base );
     const MetaView<uint32_t, uint8_t> msgid( base + "midmeta", base + "middata" );
-    const HashSearch<uint8_t> midhash( base + "middata", base + "midhash", base + "midhashdata" );
+    const HashSearch<uint8_t> midhash( base + "middata", base + "midhash", base + "midhashdata", base + "midphf" );
     const StringCompress compress( base + "msgid.codebook" );
 
     const std::string dbdir( argv[1] );
@@ -210,12 +211,9 @@ int main( int argc, char** argv )
             }
             else
             {
-                auto cdata = conn[i];
-                auto parent = cdata[1];
-                if( parent == -1 )
+                if( conn.Parent( i ) == -1 )
                 {
-                    auto children = cdata[3];
-                    if( children == 0 )
+                    if( conn.ChildrenCount( i ) == 0 )
                     {
                         auto post = mview[i];
                         auto score = classifier->Predict( post );
@@ -227,7 +225,7 @@ int main( int argc, char** argv )
                     else if( thread )
                     {
                         bool allBad = true;
-                        auto toCheck = cdata[2];
+                        auto toCheck = conn.SubtreeSize( i );
                         std::vector<float> scores;
                         scores.reserve( toCheck );
                         for( int j=0; j<toCheck; j++ )
@@ -401,9 +399,7 @@ int main( int argc, char** argv )
             for( uint32_t i=0; i<topsize; i++ )
             {
                 auto idx = toplevel[i];
-                auto children = conn[idx];
-                children += 3;
-                if( *children != 0 ) continue;
+                if( conn.ChildrenCount( idx ) != 0 ) continue;
                 char unpack[2048];
                 compress.Unpack( msgid[idx], unpack );
                 std::string id( unpack );
@@ -425,7 +421,7 @@ int main( int argc, char** argv )
             auto post = mview[idx];
             auto raw = mview.Raw( idx );
 
-            time_t date = *conn[idx];
+            time_t date = conn.Date( idx );
             auto lt = localtime( &date );
             char buf[64];
             auto dlen = strftime( buf, 64, "%F %R", lt );
@@ -20,6 +20,7 @@
 #include "../common/MetaView.hpp"
 #include "../common/MessageLogic.hpp"
 #include "../common/MsgIdHash.hpp"
+#include "../common/PerfectHash.hpp"
 #include "../common/ReferencesParent.hpp"
 #include "../common/Slab.hpp"
 #include "../common/StringCompress.hpp"
@@ -316,11 +317,34 @@ int main( int argc, char** argv )
 
             assert( cnt == unique );
             fwrite( msgidoffset, 1, unique * sizeof( uint64_t ), strmeta );
-            delete[] msgidoffset;
 
             fclose( data );
             fclose( strdata );
             fclose( strmeta );
+
+            printf( "Building perfect hash...\n" );
+            fflush( stdout );
+            PerfectHashBuilder phf;
+            if( phf.Build( (const char* const*)msgidvec.data(), unique ) )
+            {
+                auto slots = new uint64_t[unique*2];
+                for( uint32_t i=0; i<unique; i++ )
+                {
+                    const auto pos = phf.Position( i );
+                    slots[pos*2] = msgidoffset[i];
+                    slots[pos*2+1] = i;
+                }
+                FILE* fphf = fopen( ( base + "midhash.phf" ).c_str(), "wb" );
+                phf.Write( fphf, slots, sizeof( uint64_t ) * 2 );
+                fclose( fphf );
+                delete[] slots;
+            }
+            else
+            {
+                fprintf( stderr, "Cannot build perfect hash, message ids are not unique.\n" );
+                remove( ( base + "midhash.phf" ).c_str() );
+            }
+            delete[] msgidoffset;
         }
 
         delete[] hashdata;
@@ -339,7 +363,7 @@ int main( int argc, char** argv )
     std::map<uint32_t, IndirectData> indirect;
 
     {
-        const HashSearchBig midhash( base + "msgid", base + "midhash.meta", base + "midhash" );
+        const HashSearchBig midhash( base + "msgid", base + "midhash.meta", base + "midhash", base + "midhash.phf" );
 
         struct VectorHasher
         {
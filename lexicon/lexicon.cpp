@@ -10,9 +10,11 @@
 
 #include "../contrib/xxhash/xxhash.h"
 #include "../common/Alloc.hpp"
+#include "../common/Connectivity.hpp"
+#include "../common/FileMap.hpp"
 #include "../common/ICU.hpp"
+#include "../common/LexiconDictionary.hpp"
 #include "../common/LexiconTypes.hpp"
-#include "../common/MetaView.hpp"
 #include "../common/MessageLogic.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/MsgIdHash.hpp"
@@ -116,8 +118,8 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
-    MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    MessageView mview( base + "meta", base + "data", FileAccess::Sequential );
+    const ConnectivityView conn( base );
     const auto size = mview.Size();
     std::vector<std::string> wordbuf;
 
@@ -138,7 +140,7 @@ int main( int argc, char** argv )
         int wrote;
         int basePos[NUM_LEXICON_TYPES] = {};
 
-        int children = LexiconTransformChildNum( conn[i][2] - 1 );
+        int children = LexiconTransformChildNum( conn.SubtreeSize( i ) - 1 );
 
         auto post = mview[i];
         for(;;)
@@ -292,8 +294,10 @@ int main( int argc, char** argv )
 
     printf( "\n" );
 
+    const uint8_t layout = HashLayoutFor( wordNum );
     FILE* fhashdata = fopen( ( base + "lexhashdata" ).c_str(), "wb" );
     fwrite( &distmax, 1, 1, fhashdata );
+    fwrite( &layout, 1, 1, fhashdata );
     fclose( fhashdata );
 
     FILE* fhash = fopen( ( base + "lexhash" ).c_str(), "wb" );
@@ -320,13 +324,18 @@ int main( int argc, char** argv )
         }
         else
         {
+            auto str = strings[hashdata[i]];
+            const auto len = strlen( str );
+            const uint32_t hash = XXH32( str, len, 0 );
+
+            const uint32_t idx = layout == HashLayoutTagged ? ( hashdata[i] | ( hash & HashTagMask ) ) : hashdata[i];
+
             fwrite( &stroffset, 1, sizeof( uint32_t ), fhash );
-            fwrite( hashdata+i, 1, sizeof( uint32_t ), fhash );
+            fwrite( &idx, 1, sizeof( uint32_t ), fhash );
 
             offsetData[hashdata[i]] = stroffset;
             cnt++;
-            auto str = strings[hashdata[i]];
-            stroffset += fwrite( str, 1, strlen( str ) + 1, fstr );
+            stroffset += fwrite( str, 1, len + 1, fstr );
         }
     }
     assert( cnt == hashsize );
@@ -393,5 +402,14 @@ int main( int argc, char** argv )
     fclose( fdata );
     fclose( fhit );
 
+    {
+        const FileMap<LexiconMetaPacket> meta( base + "lexmeta" );
+        const FileMap<char> str( base + "lexstr" );
+        LexiconDictionary::Write( base, meta, meta.DataSize(), str );
+    }
+
+    // Compressed posting lists are written by lexsort.
+    remove( ( base + "lexpost" ).c_str() );
+
     return 0;
 }
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "../common/FileMap.hpp"
+#include "../common/LexiconPosting.hpp"
 #include "../common/LexiconTypes.hpp"
 
 int main( int argc, char** argv )
@@ -84,6 +85,8 @@ int main( int argc, char** argv )
     fclose( fdata );
     fclose( fhits );
 
+    LexiconPostingWriter::Write( base, meta, size, data, hits );
+
     delete[] data;
     delete[] hits;
 
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <iterator>
 #include <time.h>
 #include <regex>
@@ -8,61 +9,75 @@
 #include "PackageAccess.hpp"
 #include "Score.hpp"
 
+#include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/String.hpp"
 #include "../common/Package.hpp"
+#include "../common/TaskDispatch.hpp"
 
-Archive* Archive::Open( const std::string& fn )
+static std::atomic<uint32_t> s_archiveId( 0 );
+
+Archive* Archive::Open( const std::string& fn, bool warm )
 {
+    Archive* ret;
     if( IsFile( fn ) )
     {
         auto pkg = PackageAccess::Open( fn );
         if( !pkg ) return nullptr;
-        if( pkg->Version() < PackageVersion ) return nullptr;
-        return new Archive( pkg );
+        if( pkg->Version() < PackageMinVersion ) return nullptr;
+        ret = new Archive( pkg );
     }
     else
     {
         auto base = fn + "/";
         if( !Exists( base + "zmeta" ) || !Exists( base + "zdata" ) || !Exists( base + "zdict" ) ||
-            !Exists( base + "toplevel" ) || !Exists( base + "connmeta" ) || !Exists( base + "conndata" ) ||
-            !Exists( base + "middata" ) || !Exists( base + "midhash" ) || !Exists( base + "midhashdata" ) || !Exists( base + "midmeta" ) ||
+            !Exists( base + "toplevel" ) || ( ( !Exists( base + "connmeta" ) || !Exists( base + "conndata" ) ) && !Exists( base + "conncol" ) ) ||
+            !Exists( base + "middata" ) || ( !Exists( base + "midhash" ) && !Exists( base + "midphf" ) ) || !Exists( base + "midhashdata" ) || !Exists( base + "midmeta" ) ||
             !Exists( base + "strmeta" ) || !Exists( base + "strings" ) || !Exists( base + "lexmeta" ) ||
-            !Exists( base + "lexstr" ) || !Exists( base + "lexdata" ) || !Exists( base + "lexhit" ) ||
+            !Exists( base + "lexstr" ) || ( ( !Exists( base + "lexdata" ) || !Exists( base + "lexhit" ) ) && !Exists( base + "lexpost" ) ) ||
             !Exists( base + "lexstr" ) || !Exists( base + "lexhash" ) || !Exists( base + "lexhashdata" ) )
         {
             return nullptr;
         }
         else
         {
-            return new Archive( base );
+            ret = new Archive( base );
         }
     }
+    if( warm )
+    {
+        ret->m_warm = std::thread( [ret] { ret->Warm( &ret->m_warmStop ); } );
+    }
+    return ret;
 }
 
 Archive::Archive( const std::string& dir )
     : m_mview( dir + "zmeta", dir + "zdata", dir + "zdict" )
     , m_mcnt( m_mview.Size() )
     , m_toplevel( dir + "toplevel" )
-    , m_midhash( dir + "middata", dir + "midhash", dir + "midhashdata" )
+    , m_descShort( dir + "desc_short", true )
+    , m_descLong( dir + "desc_long", true )
+    , m_name( dir + "name", true )
+    , m_prefix( dir + "prefix", true )
+    , m_midhash( dir + "middata", dir + "midhash", dir + "midhashdata", dir + "midphf" )
     , m_middb( dir + "midmeta", dir + "middata" )
-    , m_connectivity( dir + "connmeta", dir + "conndata" )
+    , m_connectivity( dir )
+    , m_timeidx( dir )
     , m_strings( dir + "strmeta", dir + "strings" )
     , m_lexmeta( dir + "lexmeta" )
     , m_lexstr( dir + "lexstr" )
     , m_lexdata( dir + "lexdata" )
     , m_lexhit( dir + "lexhit" )
+    , m_lexpost( dir + "lexpost" )
     , m_lexhash( dir + "lexstr", dir + "lexhash", dir + "lexhashdata" )
-    , m_descShort( dir + "desc_short", true )
-    , m_descLong( dir + "desc_long", true )
-    , m_name( dir + "name", true )
-    , m_prefix( dir + "prefix", true )
+    , m_lexdict( dir )
     , m_compress( dir + "msgid.codebook" )
+    , m_lexdist( dir + "lexdistmeta", dir + "lexdist" )
+    , m_hasLexdist( Exists( dir + "lexdist" ) && Exists( dir + "lexdistmeta" ) )
+    , m_hasLexpost( Exists( dir + "lexpost" ) )
+    , m_id( s_archiveId.fetch_add( 1, std::memory_order_relaxed ) )
+    , m_warmStop( false )
 {
-    if( Exists( dir + "lexdist" ) && Exists( dir + "lexdistmeta" ) )
-    {
-        m_lexdist = std::make_unique<MetaView<uint32_t, uint32_t>>( dir + "lexdistmeta", dir + "lexdist" );
-    }
 }
 
 Archive::Archive( const PackageAccess* pkg )
@@ -70,26 +85,127 @@ Archive::Archive( const PackageAccess* pkg )
     , m_mview( pkg->Get( PackageFile::zmeta ), pkg->Get( PackageFile::zdata ), pkg->Get( PackageFile::zdict ) )
     , m_mcnt( m_mview.Size() )
     , m_toplevel( pkg->Get( PackageFile::toplevel ) )
-    , m_midhash( pkg->Get( PackageFile::middata ), pkg->Get( PackageFile::midhash ), pkg->Get( PackageFile::midhashdata ) )
+    , m_descShort( pkg->Get( PackageFile::desc_short ) )
+    , m_descLong( pkg->Get( PackageFile::desc_long ) )
+    , m_name( pkg->Get( PackageFile::name ) )
+    , m_prefix( pkg->Get( PackageFile::prefix ) )
+    , m_midhash( pkg->Get( PackageFile::middata ), pkg->Get( PackageFile::midhash ), pkg->Get( PackageFile::midhashdata ), pkg->Get( PackageFile::midphf ) )
     , m_middb( pkg->Get( PackageFile::midmeta ), pkg->Get( PackageFile::middata ) )
-    , m_connectivity( pkg->Get( PackageFile::connmeta ), pkg->Get( PackageFile::conndata ) )
+    , m_connectivity( pkg->Get( PackageFile::conncol ), pkg->Get( PackageFile::connmeta ), pkg->Get( PackageFile::conndata ) )
+    , m_timeidx( pkg->Get( PackageFile::timeidx ), pkg->Get( PackageFile::conncol ), pkg->Get( PackageFile::connmeta ), pkg->Get( PackageFile::conndata ) )
     , m_strings( pkg->Get( PackageFile::strmeta ), pkg->Get( PackageFile::strings ) )
     , m_lexmeta( pkg->Get( PackageFile::lexmeta ) )
     , m_lexstr( pkg->Get( PackageFile::lexstr ) )
     , m_lexdata( pkg->Get( PackageFile::lexdata ) )
     , m_lexhit( pkg->Get( PackageFile::lexhit ) )
+    , m_lexpost( pkg->Get( PackageFile::lexpost ) )
     , m_lexhash( pkg->Get( PackageFile::lexstr ), pkg->Get( PackageFile::lexhash ), pkg->Get( PackageFile::lexhashdata ) )
-    , m_descShort( pkg->Get( PackageFile::desc_short ) )
-    , m_descLong( pkg->Get( PackageFile::desc_long ) )
-    , m_name( pkg->Get( PackageFile::name ) )
-    , m_prefix( pkg->Get( PackageFile::prefix ) )
+    , m_lexdict( pkg->Get( PackageFile::lexdict ), pkg->Get( PackageFile::lexmeta ), pkg->Get( PackageFile::lexstr ) )
     , m_compress( pkg->Get( PackageFile::codebook ) )
+    , m_lexdist( pkg->Get( PackageFile::lexdistmeta ), pkg->Get( PackageFile::lexdist ) )
+    , m_hasLexdist( pkg->Get( PackageFile::lexdist ).size > 0 && pkg->Get( PackageFile::lexdistmeta ).size > 0 )
+    , m_hasLexpost( pkg->Get( PackageFile::lexpost ).size > 0 )
+    , m_id( s_archiveId.fetch_add( 1, std::memory_order_relaxed ) )
+    , m_warmStop( false )
 {
-    const auto lexdist = pkg->Get( PackageFile::lexdist );
-    const auto lexdistmeta = pkg->Get( PackageFile::lexdistmeta );
-    if( lexdist.size > 0 && lexdistmeta.size > 0 )
+}
+
+Archive::~Archive()
+{
+    if( m_warm.joinable() )
     {
-        m_lexdist = std::make_unique<MetaView<uint32_t, uint32_t>>( lexdistmeta, lexdist );
+        m_warmStop.store( true, std::memory_order_relaxed );
+        m_warm.join();
+    }
+}
+
+void Archive::Warm( const std::atomic<bool>* stop ) const
+{
+    enum : uint32_t { P = FileAccess::Populate };
+    // Small tables read by nearly every request are kept resident.
+    enum : uint32_t { Hot = FileAccess::Lock };
+    const std::function<void()> sections[] = {
+        [this] { m_toplevel.Advise( Hot ); },
+        [this] { m_connectivity->Advise( Hot ); },
+        [this] { m_strings->Advise( P, P ); },
+        [this] { m_midhash->Advise( P ); },
+        [this] { m_mview.Advise( P, FileAccess::Normal ); },
+        [this] { m_lexmeta->Advise( Hot ); },
+        [this] { m_lexhash->Advise( P ); },
+    };
+    for( auto& v : sections )
+    {
+        if( stop && stop->load( std::memory_order_relaxed ) ) return;
+        v();
+    }
+}
+
+const char* Archive::GetMessage( uint32_t idx, ExpandingBuffer& eb ) const
+{
+    if( idx >= m_mcnt ) return nullptr;
+    if( !m_cache ) return m_mview.GetMessage( idx, eb );
+    auto ret = m_cache->Get( m_id, idx, eb );
+    if( ret ) return ret;
+    ret = m_mview.GetMessage( idx, eb );
+    m_cache->Insert( m_id, idx, ret, m_mview.Raw( idx ).size );
+    return ret;
+}
+
+const char* Archive::GetMessagePart( uint32_t idx, ExpandingBuffer& eb, size_t maxBytes, size_t bodyLines, size_t* skipped ) const
+{
+    if( idx >= m_mcnt ) return nullptr;
+    size_t tmp;
+    return m_mview.GetMessagePart( idx, eb, maxBytes, bodyLines, skipped ? *skipped : tmp );
+}
+
+void Archive::GetMessages( ViewReference<uint32_t> indices, const MessageCallback& cb, TaskDispatch* td ) const
+{
+    enum { BatchSize = 64 };
+
+    std::vector<uint32_t> order;
+    order.reserve( indices.size );
+    for( uint64_t i=0; i<indices.size; i++ )
+    {
+        if( indices.ptr[i] < m_mcnt ) order.emplace_back( indices.ptr[i] );
+    }
+    if( order.empty() ) return;
+    std::sort( order.begin(), order.end(), [this]( const auto& l, const auto& r ) { return m_mview.Raw( l ).ptr < m_mview.Raw( r ).ptr; } );
+    order.erase( std::unique( order.begin(), order.end() ), order.end() );
+
+    m_mview.Prefetch( order.data(), order.size() );
+
+    const auto size = order.size();
+    if( !td || size <= BatchSize )
+    {
+        ExpandingBuffer eb;
+        for( auto& idx : order )
+        {
+            cb( idx, m_mview.GetMessage( idx, eb ), m_mview.Raw( idx ).size );
+        }
+    }
+    else
+    {
+        // Each job takes a run of adjacent messages, to keep the data access linear.
+        std::atomic<size_t> cnt( 0 );
+        const auto workers = td->NumberOfWorkers();
+        for( size_t t=0; t<workers; t++ )
+        {
+            td->Queue( [this, &cnt, &order, &cb, size] {
+                ExpandingBuffer eb;
+                for(;;)
+                {
+                    const auto start = cnt.fetch_add( BatchSize, std::memory_order_relaxed );
+                    if( start >= size ) return;
+                    const auto end = std::min<size_t>( start + BatchSize, size );
+                    for( size_t i=start; i<end; i++ )
+                    {
+                        const auto idx = order[i];
+                        cb( idx, m_mview.GetMessage( idx, eb ), m_mview.Raw( idx ).size );
+                    }
+                }
+            } );
+        }
+        td->Sync();
     }
 }
 
@@ -148,15 +264,41 @@ std::map<std::string, uint32_t> Archive::TimeChart() const
 {
     std::map<std::string, uint32_t> ret;
 
-    const auto size = m_connectivity.Size();
-    for( size_t i=0; i<size; i++ )
+    for( auto& v : m_timeidx->Histogram( TimeGranularity::Month ) )
     {
-        const auto epoch = time_t( *m_connectivity[i] );
-        if( epoch == 0 ) continue;
+        const auto epoch = time_t( v.start );
         char buf[16];
         strftime( buf, 16, "%Y%m", gmtime( &epoch ) );
-        ret[buf]++;
+        ret.emplace( buf, v.count );
+    }
+
+    return ret;
+}
+
+ViewReference<uint32_t> Archive::MessagesInRange( uint32_t from, uint32_t to ) const
+{
+    const auto range = m_timeidx->Range( from, to );
+    return ViewReference<uint32_t> { range.first, uint64_t( range.second - range.first ) };
+}
+
+std::vector<const char*> Archive::CompleteWord( const char* prefix, size_t limit ) const
+{
+    const auto& meta = *m_lexmeta;
+    const auto range = m_lexdict->Prefix( prefix, strlen( prefix ) );
+    std::vector<uint32_t> words( range.first, range.second );
+    const auto cmp = [&meta] ( uint32_t l, uint32_t r ) { return meta[l].dataSize > meta[r].dataSize; };
+    if( limit < words.size() )
+    {
+        std::partial_sort( words.begin(), words.begin() + limit, words.end(), cmp );
+        words.resize( limit );
+    }
+    else
+    {
+        std::sort( words.begin(), words.end(), cmp );
     }
 
+    std::vector<const char*> ret;
+    ret.reserve( words.size() );
+    for( auto& v : words ) ret.emplace_back( m_lexdict->Word( v ) );
     return ret;
 }
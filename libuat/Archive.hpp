@@ -1,79 +1,133 @@
 #ifndef __ARCHIVE_HPP__
 #define __ARCHIVE_HPP__
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "../common/Connectivity.hpp"
 #include "../common/FileMap.hpp"
 #include "../common/HashSearch.hpp"
+#include "../common/LexiconDictionary.hpp"
+#include "../common/LexiconPosting.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/TimeIndex.hpp"
 #include "../common/ZMessageView.hpp"
 
+#include "LazySection.hpp"
+#include "MessageCache.hpp"
 #include "PackageAccess.hpp"
+#include "SearchCache.hpp"
 #include "ViewReference.hpp"
 
 struct ScoreEntry;
 class ExpandingBuffer;
+class TaskDispatch;
 
 class Archive
 {
     friend class SearchEngine;
 
 public:
-    static Archive* Open( const std::string& fn );
-
-    const char* GetMessage( uint32_t idx, ExpandingBuffer& eb ) { return idx >= m_mcnt ? nullptr : m_mview.GetMessage( idx, eb ); }
-    const char* GetMessage( const uint8_t* msgid, ExpandingBuffer& eb ) { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetMessage( idx, eb ) : nullptr; }
+    // Warm archive pre-faults its hot sections in a background thread.
+    static Archive* Open( const std::string& fn, bool warm = false );
+    ~Archive();
+
+    // Synchronously reads in thread structure, strings and hash tables. Returns early if stop is set.
+    // Thread structure, top level list and lexicon meta are also locked in memory, as far as
+    // RLIMIT_MEMLOCK allows.
+    void Warm( const std::atomic<bool>* stop = nullptr ) const;
+
+    // Thread safe, as long as each thread uses its own buffer.
+    const char* GetMessage( uint32_t idx, ExpandingBuffer& eb ) const;
+    const char* GetMessage( const uint8_t* msgid, ExpandingBuffer& eb ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetMessage( idx, eb ) : nullptr; }
     size_t NumberOfMessages() const { return m_mcnt; }
 
-    int GetMessageIndex( const uint8_t* msgid ) const { return m_midhash.Search( msgid ); }
-    int GetMessageIndex( const uint8_t* msgid, XXH32_hash_t hash ) const { return m_midhash.Search( msgid, hash ); }
-    const uint8_t* GetMessageId( uint32_t idx ) const { return m_middb[idx]; }
+    // Partial decoding, for consumers which only look at the beginning of a
+    // message. Headers include the empty line ending them. Skipped, if given,
+    // receives the number of message bytes which were not decoded. Message
+    // cache is bypassed.
+    const char* GetMessageHeaders( uint32_t idx, ExpandingBuffer& eb, size_t* skipped = nullptr ) const { return GetMessagePart( idx, eb, ZMessageView::NoLimit, 0, skipped ); }
+    const char* GetMessagePart( uint32_t idx, ExpandingBuffer& eb, size_t maxBytes, size_t bodyLines, size_t* skipped = nullptr ) const;
+
+    // Retrieves a batch of messages in storage order, after prefetching the
+    // compressed data. Callback receives message index, text and text size;
+    // text is only valid during the call. Invalid indices are skipped. With
+    // a task dispatcher messages are decoded in parallel and the callback is
+    // called concurrently from the worker threads. Message cache is bypassed.
+    using MessageCallback = std::function<void(uint32_t, const char*, size_t)>;
+    void GetMessages( ViewReference<uint32_t> indices, const MessageCallback& cb, TaskDispatch* td = nullptr ) const;
+
+    // Cache may be shared between archives. Set to nullptr to disable caching (default).
+    void SetMessageCache( const std::shared_ptr<MessageCache>& cache ) { m_cache = cache; }
+    const std::shared_ptr<MessageCache>& GetMessageCache() const { return m_cache; }
+
+    // Search engines of the archive look up and store query results in the cache. Set to nullptr to disable caching (default).
+    void SetSearchCache( const std::shared_ptr<SearchCache>& cache ) { m_searchCache = cache; }
+    const std::shared_ptr<SearchCache>& GetSearchCache() const { return m_searchCache; }
+
+    int GetMessageIndex( const uint8_t* msgid ) const { return m_midhash->Search( msgid ); }
+    int GetMessageIndex( const uint8_t* msgid, XXH32_hash_t hash ) const { return m_midhash->Search( msgid, hash ); }
+    const uint8_t* GetMessageId( uint32_t idx ) const { return (*m_middb)[idx]; }
 
     ViewReference<uint32_t> GetTopLevel() const { return ViewReference<uint32_t> { m_toplevel, m_toplevel.DataSize() }; }
     size_t NumberOfTopLevel() const { return m_toplevel.DataSize(); }
 
-    int32_t GetParent( uint32_t idx ) const { auto data = m_connectivity[idx]; return (int32_t)*(data+1); }
-    int32_t GetParent( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetParent( idx ) : -1; }
+    int32_t GetParent( uint32_t idx ) const { return m_connectivity->Parent( idx ); }
+    int32_t GetParent( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetParent( idx ) : -1; }
+    uint32_t GetRoot( uint32_t idx ) const { return m_connectivity->Root( idx ); }
 
-    ViewReference<uint32_t> GetChildren( uint32_t idx ) const { auto data = ( m_connectivity[idx] ) + 3; auto num = *data++; return ViewReference<uint32_t> { data, num }; }
-    ViewReference<uint32_t> GetChildren( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetChildren( idx ) : ViewReference<uint32_t> { nullptr, 0 }; }
+    ViewReference<uint32_t> GetChildren( uint32_t idx ) const { return ViewReference<uint32_t> { m_connectivity->Children( idx ), m_connectivity->ChildrenCount( idx ) }; }
+    ViewReference<uint32_t> GetChildren( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetChildren( idx ) : ViewReference<uint32_t> { nullptr, 0 }; }
 
-    uint32_t GetTotalChildrenCount( uint32_t idx ) const { auto data = m_connectivity[idx]; return data[2]; }
-    uint32_t GetTotalChildrenCount( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetTotalChildrenCount( idx ) : 0; }
+    uint32_t GetTotalChildrenCount( uint32_t idx ) const { return m_connectivity->SubtreeSize( idx ); }
+    uint32_t GetTotalChildrenCount( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetTotalChildrenCount( idx ) : 0; }
 
-    uint32_t GetDate( uint32_t idx ) const { auto data = m_connectivity[idx]; return *data; }
-    uint32_t GetDate( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetDate( idx ) : 0; }
+    uint32_t GetDate( uint32_t idx ) const { return m_connectivity->Date( idx ); }
+    uint32_t GetDate( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetDate( idx ) : 0; }
 
-    const char* GetFrom( uint32_t idx ) const { return m_strings[idx*3]; }
-    const char* GetFrom( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetFrom( idx ) : nullptr; }
+    const char* GetFrom( uint32_t idx ) const { return (*m_strings)[idx*3]; }
+    const char* GetFrom( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetFrom( idx ) : nullptr; }
 
-    const char* GetSubject( uint32_t idx ) const { return m_strings[idx*3+1]; }
-    const char* GetSubject( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetSubject( idx ) : nullptr; }
+    const char* GetSubject( uint32_t idx ) const { return (*m_strings)[idx*3+1]; }
+    const char* GetSubject( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetSubject( idx ) : nullptr; }
 
-    const char* GetRealName( uint32_t idx ) const { return m_strings[idx*3+2]; }
-    const char* GetRealName( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetRealName( idx ) : nullptr; }
+    const char* GetRealName( uint32_t idx ) const { return (*m_strings)[idx*3+2]; }
+    const char* GetRealName( const uint8_t* msgid ) const { auto idx = m_midhash->Search( msgid ); return idx >= 0 ? GetRealName( idx ) : nullptr; }
 
     int GetMessageScore( uint32_t idx, const std::vector<ScoreEntry>& scoreList ) const;
 
+    // Number of messages per calendar month, keyed by "YYYYMM".
     std::map<std::string, uint32_t> TimeChart() const;
 
+    // Messages dated in [from, to), ordered by date. Messages without date are not included.
+    ViewReference<uint32_t> MessagesInRange( uint32_t from, uint32_t to ) const;
+    // Non-empty buckets only, in time order.
+    std::vector<TimeBucket> Histogram( TimeGranularity::type granularity ) const { return m_timeidx->Histogram( granularity ); }
+    // Dates of the oldest and the newest message. Both are zero if no message has a date.
+    std::pair<uint32_t, uint32_t> DateRange() const { return std::make_pair( m_timeidx->First(), m_timeidx->Last() ); }
+
     std::pair<const char*, uint64_t> GetShortDescription() const { return std::make_pair( (const char*)m_descShort, m_descShort.Size() ); }
     std::pair<const char*, uint64_t> GetLongDescription() const { return std::make_pair( (const char*)m_descLong, m_descLong.Size() ); }
     std::pair<const char*, uint64_t> GetArchiveName() const { return std::make_pair( ( const char*)m_name, m_name.Size() ); }
     std::pair<const char*, uint64_t> GetPrefixList() const { return std::make_pair( ( const char*)m_prefix, m_prefix.Size() ); }
 
-    size_t PackMsgId( const char* msgid, uint8_t* compressed ) const { return m_compress.Pack( msgid, compressed ); }
-    size_t UnpackMsgId( const uint8_t* compressed, char* msgid ) const { return m_compress.Unpack( compressed, msgid ); }
-    size_t RepackMsgId( const uint8_t* in, uint8_t* out, const StringCompress& other ) const { return m_compress.Repack( in, out, other ); }
-    const StringCompress& GetCompress() const { return m_compress; }
+    size_t PackMsgId( const char* msgid, uint8_t* compressed ) const { return m_compress->Pack( msgid, compressed ); }
+    size_t UnpackMsgId( const uint8_t* compressed, char* msgid ) const { return m_compress->Unpack( compressed, msgid ); }
+    size_t RepackMsgId( const uint8_t* in, uint8_t* out, const StringCompress& other ) const { return m_compress->Repack( in, out, other ); }
+    const StringCompress& GetCompress() const { return *m_compress; }
 
-    bool HasLexDist() const { return (bool)m_lexdist; }
+    bool HasLexDist() const { return m_hasLexdist; }
+
+    // Up to limit words starting with prefix, most frequent first.
+    std::vector<const char*> CompleteWord( const char* prefix, size_t limit ) const;
 
 private:
     Archive( const std::string& dir );
@@ -81,24 +135,38 @@ private:
 
     std::unique_ptr<const PackageAccess> m_pkg;
 
-    ZMessageView m_mview;
+    const ZMessageView m_mview;
     const size_t m_mcnt;
     const FileMap<uint32_t> m_toplevel;
-    const HashSearch<uint8_t> m_midhash;
-    const MetaView<uint32_t, uint8_t> m_middb;
-    const MetaView<uint32_t, uint32_t> m_connectivity;
-    const MetaView<uint32_t, char> m_strings;
-    const FileMap<LexiconMetaPacket> m_lexmeta;
-    const FileMap<char> m_lexstr;
-    const FileMap<LexiconDataPacket> m_lexdata;
-    const FileMap<uint8_t> m_lexhit;
-    const HashSearch<char> m_lexhash;
     const FileMap<char> m_descShort;
     const FileMap<char> m_descLong;
     const FileMap<char> m_name;
     const FileMap<char> m_prefix;
-    const StringCompress m_compress;
-    std::unique_ptr<MetaView<uint32_t, uint32_t>> m_lexdist;
+
+    // Sections below are mapped on first use.
+    const LazySection<HashSearch<uint8_t>> m_midhash;
+    const LazySection<MetaView<uint32_t, uint8_t>> m_middb;
+    const LazySection<ConnectivityView> m_connectivity;
+    const LazySection<TimeIndex> m_timeidx;
+    const LazySection<MetaView<uint32_t, char>> m_strings;
+    const LazySection<FileMap<LexiconMetaPacket>> m_lexmeta;
+    const LazySection<FileMap<char>> m_lexstr;
+    const LazySection<FileMap<LexiconDataPacket>> m_lexdata;
+    const LazySection<FileMap<uint8_t>> m_lexhit;
+    const LazySection<LexiconPostingView> m_lexpost;
+    const LazySection<HashSearch<char>> m_lexhash;
+    const LazySection<LexiconDictionary> m_lexdict;
+    const LazySection<StringCompress> m_compress;
+    const LazySection<MetaView<uint32_t, uint32_t>> m_lexdist;
+    const bool m_hasLexdist;
+    const bool m_hasLexpost;
+
+    const uint32_t m_id;
+    std::shared_ptr<MessageCache> m_cache;
+    std::shared_ptr<SearchCache> m_searchCache;
+
+    std::thread m_warm;
+    std::atomic<bool> m_warmStop;
 };
 
 #endif
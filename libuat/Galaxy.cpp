@@ -6,7 +6,7 @@
 
 #include "Galaxy.hpp"
 
-Galaxy* Galaxy::Open( const std::string& fn )
+Galaxy* Galaxy::Open( const std::string& fn, bool warm )
 {
     if( !Exists( fn ) || IsFile( fn ) ) return nullptr;
 
@@ -23,14 +23,14 @@ Galaxy* Galaxy::Open( const std::string& fn )
     }
     else
     {
-        return new Galaxy( base );
+        return new Galaxy( base, warm );
     }
 }
 
-Galaxy::Galaxy( const std::string& fn )
+Galaxy::Galaxy( const std::string& fn, bool warm )
     : m_base( fn )
     , m_middb( fn + "msgid.meta", fn + "msgid" )
-    , m_midhash( fn + "msgid", fn + "midhash.meta", fn + "midhash" )
+    , m_midhash( fn + "msgid", fn + "midhash.meta", fn + "midhash", fn + "midhash.phf" )
     , m_archives( fn + "archives.meta", fn + "archives" )
     , m_strings( fn + "str.meta", fn + "str" )
     , m_midgr( fn + "midgr.meta", fn + "midgr" )
@@ -38,6 +38,7 @@ Galaxy::Galaxy( const std::string& fn )
     , m_indirectDense( fn + "indirect.dense" )
     , m_compress( fn + "msgid.codebook" )
     , m_arch( m_archives.Size() / 2 )
+    , m_warmStop( false )
 {
     const auto size = m_archives.Size() / 2;
     m_available.reserve( size );
@@ -79,6 +80,26 @@ Galaxy::Galaxy( const std::string& fn )
         } );
     }
     td.Sync();
+
+    if( warm )
+    {
+        m_warm = std::thread( [this] {
+            for( auto& v : m_available )
+            {
+                if( m_warmStop.load( std::memory_order_relaxed ) ) return;
+                m_arch[v]->Warm( &m_warmStop );
+            }
+        } );
+    }
+}
+
+Galaxy::~Galaxy()
+{
+    if( m_warm.joinable() )
+    {
+        m_warmStop.store( true, std::memory_order_relaxed );
+        m_warm.join();
+    }
 }
 
 const std::shared_ptr<Archive>& Galaxy::GetArchive( int idx, bool change )
@@ -90,6 +111,22 @@ const std::shared_ptr<Archive>& Galaxy::GetArchive( int idx, bool change )
     return m_arch[idx];
 }
 
+void Galaxy::SetMessageCache( const std::shared_ptr<MessageCache>& cache )
+{
+    for( auto& v : m_arch )
+    {
+        if( v ) v->SetMessageCache( cache );
+    }
+}
+
+void Galaxy::SetSearchCache( const std::shared_ptr<SearchCache>& cache )
+{
+    for( auto& v : m_arch )
+    {
+        if( v ) v->SetSearchCache( cache );
+    }
+}
+
 bool Galaxy::AreChildrenSame( uint32_t idx, const uint8_t* msgid ) const
 {
     auto ptr = m_midgr[idx];
@@ -2,8 +2,10 @@
 #define __GALAXY_HPP__
 
 #include <assert.h>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../common/FileMap.hpp"
@@ -17,7 +19,9 @@
 class Galaxy
 {
 public:
-    static Galaxy* Open( const std::string& fn );
+    // Warm galaxy pre-faults hot sections of all archives in a background thread.
+    static Galaxy* Open( const std::string& fn, bool warm = false );
+    ~Galaxy();
 
     size_t GetNumberOfArchives() const { return m_arch.size(); }
     const std::vector<int>& GetAvailableArchives() const { return m_available; }
@@ -32,6 +36,10 @@ public:
 
     int GetActiveArchive() const { return m_active; }
 
+    // Sets message cache of all available archives.
+    void SetMessageCache( const std::shared_ptr<MessageCache>& cache );
+    void SetSearchCache( const std::shared_ptr<SearchCache>& cache );
+
     int GetMessageIndex( const uint8_t* msgid ) const { return m_midhash.Search( msgid ); }
     const uint8_t* GetMessageId( uint32_t idx ) const { return m_middb[idx]; }
 
@@ -54,7 +62,7 @@ public:
     int TotalNumberOfChildren( const uint8_t* msgid, uint32_t arch ) const;
 
 private:
-    Galaxy( const std::string& dir );
+    Galaxy( const std::string& dir, bool warm );
 
     std::string m_base;
     const MetaView<uint64_t, uint8_t> m_middb;
@@ -70,6 +78,9 @@ private:
     std::vector<int> m_available;
 
     int m_active;
+
+    std::thread m_warm;
+    std::atomic<bool> m_warmStop;
 };
 
 #endif
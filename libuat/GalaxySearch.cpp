@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <iterator>
+
+#include "../common/String.hpp"
+#include "../common/TaskDispatch.hpp"
+
+#include "Galaxy.hpp"
+#include "GalaxySearch.hpp"
+
+GalaxySearch::GalaxySearch( Galaxy& galaxy, TaskDispatch* td )
+    : m_galaxy( galaxy )
+    , m_td( td )
+{
+}
+
+static bool GalaxyResultOrder( const GalaxySearchResult& l, const GalaxySearchResult& r )
+{
+    if( l.result.rank != r.result.rank ) return l.result.rank > r.result.rank;
+    if( l.archive != r.archive ) return l.archive < r.archive;
+    return l.result.postid < r.result.postid;
+}
+
+GalaxySearchData GalaxySearch::Search( const char* query, int flags, int filter, size_t limit, size_t offset, const SearchFilter& where ) const
+{
+    assert( where.thread < 0 );
+    assert( !( flags & SearchEngine::SF_GroupThreads ) );
+
+    std::vector<std::string> terms;
+    split( query, std::back_inserter( terms ) );
+
+    // Any message of the best keep in galaxy has fewer than keep better
+    // ranked messages in the archive holding its best copy, so keep best
+    // results of each archive are enough.
+    const size_t keep = limit > SIZE_MAX - offset ? SIZE_MAX : offset + limit;
+
+    const auto& available = m_galaxy.GetAvailableArchives();
+    const auto size = available.size();
+    std::vector<SearchData> data( size );
+    const auto SearchArchive = [this, &terms, &data, &available, flags, filter, keep, &where] ( size_t i ) {
+        SearchEngine engine( *m_galaxy.GetArchive( available[i], false ) );
+        data[i] = engine.Search( terms, flags, filter, keep, 0, where );
+    };
+
+    if( m_td && m_td->NumberOfWorkers() > 1 && size > 1 )
+    {
+        std::atomic<size_t> cnt( 0 );
+        const auto workers = std::min<size_t>( m_td->NumberOfWorkers(), size );
+        for( size_t i=0; i<workers; i++ )
+        {
+            m_td->Queue( [&cnt, &SearchArchive, size] {
+                for(;;)
+                {
+                    const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                    if( i >= size ) return;
+                    SearchArchive( i );
+                }
+            } );
+        }
+        m_td->Sync();
+    }
+    else
+    {
+        for( size_t i=0; i<size; i++ ) SearchArchive( i );
+    }
+
+    GalaxySearchData ret;
+    ret.matched.resize( m_galaxy.GetNumberOfArchives() );
+    auto& results = ret.results;
+    uint8_t packed[2048];
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto aidx = available[i];
+        const auto& archive = *m_galaxy.GetArchive( aidx, false );
+        ret.total += data[i].total;
+        ret.estimated |= data[i].estimated;
+        ret.matched[aidx] = std::move( data[i].matched );
+        for( auto& v : data[i].results )
+        {
+            m_galaxy.RepackMsgId( archive.GetMessageId( v.postid ), packed, archive.GetCompress() );
+            const auto gidx = m_galaxy.GetMessageIndex( packed );
+            results.emplace_back( GalaxySearchResult { aidx, v, gidx, gidx < 0 ? ViewReference<uint32_t> { nullptr, 0 } : m_galaxy.GetGroups( gidx ) } );
+        }
+    }
+
+    // Cross-posted message keeps only its best ranked copy.
+    std::sort( results.begin(), results.end(), [] ( const GalaxySearchResult& l, const GalaxySearchResult& r ) {
+        if( l.gidx != r.gidx ) return l.gidx < r.gidx;
+        return GalaxyResultOrder( l, r );
+    } );
+    results.erase( std::unique( results.begin(), results.end(), [] ( const GalaxySearchResult& l, const GalaxySearchResult& r ) { return l.gidx >= 0 && l.gidx == r.gidx; } ), results.end() );
+
+    if( keep < results.size() )
+    {
+        std::partial_sort( results.begin(), results.begin() + keep, results.end(), GalaxyResultOrder );
+        results.resize( keep );
+    }
+    else
+    {
+        std::sort( results.begin(), results.end(), GalaxyResultOrder );
+    }
+    results.erase( results.begin(), results.begin() + std::min( offset, results.size() ) );
+
+    return ret;
+}
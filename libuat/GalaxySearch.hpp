@@ -0,0 +1,50 @@
+#ifndef __GALAXYSEARCH_HPP__
+#define __GALAXYSEARCH_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "SearchEngine.hpp"
+#include "ViewReference.hpp"
+
+class Galaxy;
+class TaskDispatch;
+
+struct GalaxySearchResult
+{
+    int archive;                        // archive of the best ranked copy of the message
+    SearchResult result;                // postid and hits in that archive, words index matched[archive]
+    int32_t gidx;                       // galaxy message index, -1 if galaxy doesn't know the message
+    ViewReference<uint32_t> groups;     // archives the message was posted to, empty if gidx is -1
+};
+
+struct GalaxySearchData
+{
+    std::vector<GalaxySearchResult> results;
+    std::vector<std::vector<const char*>> matched;  // by archive index
+    size_t total = 0;                               // sum of archive totals, cross-posts are counted in each archive
+    bool estimated = false;                         // some of archive totals are estimated
+};
+
+// Searches all available archives of a galaxy. Each message is reported
+// once, with its best ranked copy, no matter how many groups it was
+// posted to. Search engine ranks don't depend on the archive, so results
+// of different archives are merged by rank directly.
+class GalaxySearch
+{
+public:
+    // With a task dispatcher, archives are searched in parallel by its
+    // workers. Dispatcher must not be used by anyone else during a search.
+    GalaxySearch( Galaxy& galaxy, TaskDispatch* td = nullptr );
+
+    // Parameters are as in SearchEngine::Search. Thread filter refers to a
+    // single archive and can't be used, neither can thread grouping.
+    GalaxySearchData Search( const char* query, int flags = SearchEngine::SF_FlagsNone, int filter = T_All, size_t limit = SearchEngine::NoLimit, size_t offset = 0, const SearchFilter& where = SearchFilter() ) const;
+
+private:
+    Galaxy& m_galaxy;
+    TaskDispatch* m_td;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __LAZYSECTION_HPP__
+#define __LAZYSECTION_HPP__
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Archive section which is constructed (files opened, mapped, headers
+// parsed) only when it is accessed for the first time. Construction
+// arguments are copied and kept until then. Safe to access from many
+// threads; after the first access the cost is a single atomic load.
+template<class T>
+class LazySection
+{
+public:
+    template<class... Args>
+    explicit LazySection( const Args&... args )
+        : m_factory( [args...] { return new T( args... ); } )
+        , m_ptr( nullptr )
+    {
+    }
+
+    ~LazySection() { delete m_ptr.load( std::memory_order_relaxed ); }
+
+    LazySection( const LazySection& ) = delete;
+    LazySection& operator=( const LazySection& ) = delete;
+
+    const T& operator*() const { return *Get(); }
+    const T* operator->() const { return Get(); }
+
+    bool IsLoaded() const { return m_ptr.load( std::memory_order_acquire ) != nullptr; }
+
+private:
+    const T* Get() const
+    {
+        auto ptr = m_ptr.load( std::memory_order_acquire );
+        if( ptr ) return ptr;
+        std::lock_guard<std::mutex> lock( m_lock );
+        ptr = m_ptr.load( std::memory_order_relaxed );
+        if( !ptr )
+        {
+            ptr = m_factory();
+            m_ptr.store( ptr, std::memory_order_release );
+        }
+        return ptr;
+    }
+
+    const std::function<T*()> m_factory;
+    mutable std::atomic<T*> m_ptr;
+    mutable std::mutex m_lock;
+};
+
+#endif
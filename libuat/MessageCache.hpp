@@ -0,0 +1,98 @@
+#ifndef __MESSAGECACHE_HPP__
+#define __MESSAGECACHE_HPP__
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+
+#include "../common/ExpandingBuffer.hpp"
+#include "../contrib/martinus/robin_hood.h"
+
+// LRU cache of decompressed messages, shared between any number of archives
+// and threads. Total size of cached message texts is kept below the budget
+// given at construction. A budget of zero disables caching.
+class MessageCache
+{
+public:
+    explicit MessageCache( size_t budget ) : m_budget( budget ), m_used( 0 ), m_hits( 0 ), m_misses( 0 ) {}
+
+    MessageCache( const MessageCache& ) = delete;
+    MessageCache& operator=( const MessageCache& ) = delete;
+
+    // Copies cached message to buffer and returns it, or nullptr if the message is not cached.
+    const char* Get( uint32_t archive, uint32_t idx, ExpandingBuffer& eb )
+    {
+        if( m_budget == 0 ) return nullptr;
+        std::lock_guard<std::mutex> lock( m_lock );
+        auto it = m_map.find( Key( archive, idx ) );
+        if( it == m_map.end() )
+        {
+            m_misses.fetch_add( 1, std::memory_order_relaxed );
+            return nullptr;
+        }
+        m_hits.fetch_add( 1, std::memory_order_relaxed );
+        m_lru.splice( m_lru.begin(), m_lru, it->second );
+        const auto& entry = *it->second;
+        auto buf = eb.Request( entry.size + 1 );
+        memcpy( buf, entry.data.get(), entry.size + 1 );
+        return buf;
+    }
+
+    // Message must be null terminated, size excludes the terminator.
+    void Insert( uint32_t archive, uint32_t idx, const char* msg, size_t size )
+    {
+        if( size + 1 > m_budget ) return;
+        std::unique_ptr<char[]> data( new char[size+1] );
+        memcpy( data.get(), msg, size + 1 );
+
+        std::lock_guard<std::mutex> lock( m_lock );
+        const auto key = Key( archive, idx );
+        if( m_map.find( key ) != m_map.end() ) return;
+        m_used += size + 1;
+        while( m_used > m_budget )
+        {
+            auto& last = m_lru.back();
+            m_used -= last.size + 1;
+            m_map.erase( last.key );
+            m_lru.pop_back();
+        }
+        m_lru.emplace_front( Entry { key, size, std::move( data ) } );
+        m_map.emplace( key, m_lru.begin() );
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+        m_map.clear();
+        m_lru.clear();
+        m_used = 0;
+    }
+
+    size_t Budget() const { return m_budget; }
+    size_t Used() const { std::lock_guard<std::mutex> lock( m_lock ); return m_used; }
+    uint64_t Hits() const { return m_hits.load( std::memory_order_relaxed ); }
+    uint64_t Misses() const { return m_misses.load( std::memory_order_relaxed ); }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        size_t size;
+        std::unique_ptr<char[]> data;
+    };
+
+    static uint64_t Key( uint32_t archive, uint32_t idx ) { return ( uint64_t( archive ) << 32 ) | idx; }
+
+    const size_t m_budget;
+    size_t m_used;
+    std::list<Entry> m_lru;
+    robin_hood::unordered_flat_map<uint64_t, std::list<Entry>::iterator> m_map;
+    mutable std::mutex m_lock;
+
+    std::atomic<uint64_t> m_hits, m_misses;
+};
+
+#endif
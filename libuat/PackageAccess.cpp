@@ -26,8 +26,10 @@ PackageAccess::PackageAccess( const std::string& fn, uint32_t version )
     : m_file( fn )
     , m_version( version )
 {
-    memcpy( m_sizes, m_file + PackageHeaderSize, PackageFiles * sizeof( uint64_t ) );
-    uint64_t offset = PackageHeaderSize + PackageFiles * sizeof( uint64_t );
+    const auto numfiles = PackageFilesInVersion( version );
+    memset( m_sizes, 0, sizeof( m_sizes ) );
+    memcpy( m_sizes, m_file + PackageHeaderSize, numfiles * sizeof( uint64_t ) );
+    uint64_t offset = PackageHeaderSize + numfiles * sizeof( uint64_t );
     for( int i=0; i<PackageFiles; i++ )
     {
         m_offsets[i] = offset;
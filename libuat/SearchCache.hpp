@@ -0,0 +1,168 @@
+#ifndef __SEARCHCACHE_HPP__
+#define __SEARCHCACHE_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "SearchEngine.hpp"
+#include "../contrib/martinus/robin_hood.h"
+
+// LRU cache of search results, shared between any number of archives and
+// threads. Queries are keyed by archive, search terms (as split from the
+// query string), search flags and filters. Results are stored in a compact
+// form and their total size is kept below the budget given at construction.
+// A budget of zero disables caching.
+class SearchCache
+{
+public:
+    explicit SearchCache( size_t budget ) : m_budget( budget ), m_used( 0 ), m_hits( 0 ), m_misses( 0 ) {}
+
+    SearchCache( const SearchCache& ) = delete;
+    SearchCache& operator=( const SearchCache& ) = delete;
+
+    static void MakeKey( std::string& key, uint32_t archive, const std::vector<std::string>& terms, int flags, int filter, const SearchFilter& where )
+    {
+        const uint32_t hdr[7] = { archive, uint32_t( flags ), uint32_t( filter ), where.dateFrom, where.dateTo, uint32_t( where.thread ), where.toplevel };
+        key.assign( (const char*)hdr, sizeof( hdr ) );
+        key.append( where.author );
+        key.push_back( '\0' );
+        for( auto& v : terms )
+        {
+            key.append( v );
+            key.push_back( '\0' );
+        }
+    }
+
+    // Fills data with results [offset, keep) of the query, if they are cached.
+    bool Get( const std::string& key, size_t keep, size_t offset, SearchData& data )
+    {
+        if( m_budget == 0 ) return false;
+        std::lock_guard<std::mutex> lock( m_lock );
+        auto it = m_map.find( key );
+        if( it == m_map.end() || it->second->keep < keep )
+        {
+            m_misses.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+        m_hits.fetch_add( 1, std::memory_order_relaxed );
+        m_lru.splice( m_lru.begin(), m_lru, it->second );
+        const auto& entry = *it->second;
+
+        auto& results = data.results;
+        results.clear();
+        const auto end = std::min( keep, entry.results.size() );
+        for( size_t i=offset; i<end; i++ )
+        {
+            const auto& v = entry.results[i];
+            SearchResult sr;
+            sr.postid = v.postid;
+            sr.rank = v.rank;
+            sr.hitnum = v.hitnum;
+            for( int j=0; j<v.hitnum; j++ )
+            {
+                sr.hits[j] = v.hits[j];
+                sr.words[j] = v.words[j];
+            }
+            results.emplace_back( sr );
+        }
+        data.threads.clear();
+        if( !entry.threads.empty() ) data.threads.assign( entry.threads.begin() + std::min( offset, end ), entry.threads.begin() + end );
+        data.matched = entry.matched;
+        data.total = entry.total;
+        data.estimated = entry.estimated;
+        return true;
+    }
+
+    // Data holds the best keep results of the query, ordered by rank.
+    void Insert( const std::string& key, size_t keep, const SearchData& data )
+    {
+        if( m_budget == 0 || data.matched.size() > std::numeric_limits<uint16_t>::max() ) return;
+
+        Entry entry = { key, data.total <= keep ? SIZE_MAX : keep, data.total, data.estimated, {}, data.threads, data.matched, 0 };
+        entry.results.reserve( data.results.size() );
+        for( auto& v : data.results )
+        {
+            CompactResult cr = { v.postid, v.rank, {}, v.hitnum, {} };
+            for( int j=0; j<v.hitnum; j++ )
+            {
+                cr.words[j] = uint16_t( v.words[j] );
+                cr.hits[j] = v.hits[j];
+            }
+            entry.results.emplace_back( cr );
+        }
+        entry.size = sizeof( Entry ) + key.size() * 2 + entry.results.size() * sizeof( CompactResult ) + entry.threads.size() * sizeof( SearchThread ) + entry.matched.size() * sizeof( const char* );
+        if( entry.size > m_budget ) return;
+
+        std::lock_guard<std::mutex> lock( m_lock );
+        auto it = m_map.find( key );
+        if( it != m_map.end() )
+        {
+            if( it->second->keep >= entry.keep ) return;
+            m_used -= it->second->size;
+            m_lru.erase( it->second );
+            m_map.erase( it );
+        }
+        m_used += entry.size;
+        while( m_used > m_budget )
+        {
+            auto& last = m_lru.back();
+            m_used -= last.size;
+            m_map.erase( last.key );
+            m_lru.pop_back();
+        }
+        m_lru.emplace_front( std::move( entry ) );
+        m_map.emplace( key, m_lru.begin() );
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+        m_map.clear();
+        m_lru.clear();
+        m_used = 0;
+    }
+
+    size_t Budget() const { return m_budget; }
+    size_t Used() const { std::lock_guard<std::mutex> lock( m_lock ); return m_used; }
+    size_t Size() const { std::lock_guard<std::mutex> lock( m_lock ); return m_lru.size(); }
+    uint64_t Hits() const { return m_hits.load( std::memory_order_relaxed ); }
+    uint64_t Misses() const { return m_misses.load( std::memory_order_relaxed ); }
+
+private:
+    struct CompactResult
+    {
+        uint32_t postid;
+        float rank;
+        uint16_t words[SearchResultMaxHits];    // index in matched
+        uint8_t hitnum;
+        uint8_t hits[SearchResultMaxHits];
+    };
+
+    struct Entry
+    {
+        std::string key;
+        size_t keep;        // SIZE_MAX if results are complete
+        size_t total;
+        bool estimated;
+        std::vector<CompactResult> results;
+        std::vector<SearchThread> threads;      // of grouped searches
+        std::vector<const char*> matched;
+        size_t size;        // accounted memory
+    };
+
+    const size_t m_budget;
+    size_t m_used;
+    std::list<Entry> m_lru;
+    robin_hood::unordered_flat_map<std::string, std::list<Entry>::iterator> m_map;
+    mutable std::mutex m_lock;
+
+    std::atomic<uint64_t> m_hits, m_misses;
+};
+
+#endif
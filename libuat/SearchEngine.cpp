@@ -1,16 +1,34 @@
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <functional>
 #include <iterator>
-#include <limits>
+
+#if defined __x86_64__ || defined _M_X64
+#  define SEARCH_SIMD
+#  include <emmintrin.h>
+#endif
 
 #include "Archive.hpp"
 #include "SearchEngine.hpp"
 
-#include "../contrib/martinus/robin_hood.h"
-#include "../common/Slab.hpp"
+#include "../common/MessageLogic.hpp"
 #include "../common/String.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/WordSplit.hpp"
+
+enum { RankBatch = 16*1024 };           // candidates, or their postings, gathered before they are ranked
+enum { ParallelMinCandidates = 4096 };  // smaller batches are ranked on the calling thread
+enum { ParallelBatch = 256 };
+
+static const float BoundSlack = 1.0001f;  // rank bounds are widened to cover rounding differences of the actual sums
+
+enum { PhraseVerifyBytes = 64*1024 };   // phrases which hits can't confirm are looked for in this much of the message
+enum : uint32_t { PhraseGap = 0xFFFFFFFF }; // phrase word which is not in the lexicon
 
-enum { SlabSize = 128*1024*1024 };
-static thread_local Slab<SlabSize> slab;
+enum { FuzzyMaxDistance = 2 };          // edits allowed by query-time fuzzy search
+enum { FuzzyMaxWords = 32 };            // similar words a term is extended with, closest and most used first
+static const float FuzzyDistMod[] = { 0.f, 0.01f, 0.001f, 0.0001f };
 
 enum WordFlags
 {
@@ -19,34 +37,39 @@ enum WordFlags
     WF_Cant     = 1 << 1,
     WF_From     = 1 << 2,
     WF_Subject  = 1 << 3,
+    WF_Negated  = 1 << 4,   // word of a negated phrase, its list is only read to find the phrase
 };
 
-struct PostData
+
+SearchEngine::SearchEngine( const Archive& archive, TaskDispatch* td )
+    : m_archive( archive )
+    , m_td( td )
 {
-    uint32_t postid;
-    uint8_t hitnum;
-    uint8_t children;
-    const uint8_t* hits;
-};
+}
 
+SearchData SearchEngine::Search( const char* query, int flags, int filter, size_t limit, size_t offset, const SearchFilter& where ) const
+{
+    static thread_local SearchContext ctx;
+    return Search( ctx, query, flags, filter, limit, offset, where );
+}
 
-SearchEngine::SearchEngine( const Archive& archive )
-    : m_archive( archive )
+SearchData SearchEngine::Search( const std::vector<std::string>& terms, int flags, int filter, size_t limit, size_t offset, const SearchFilter& where ) const
 {
+    static thread_local SearchContext ctx;
+    return Search( ctx, terms, flags, filter, limit, offset, where );
 }
 
-SearchData SearchEngine::Search( const char* query, int flags, int filter ) const
+const SearchData& SearchEngine::Search( SearchContext& ctx, const char* query, int flags, int filter, size_t limit, size_t offset, const SearchFilter& where ) const
 {
-    std::vector<std::string> terms;
-    split( query, std::back_inserter( terms ) );
-    return Search( terms, flags, filter );
+    ctx.m_terms.clear();
+    split( query, std::back_inserter( ctx.m_terms ) );
+    return Search( ctx, ctx.m_terms, flags, filter, limit, offset, where );
 }
 
 static float HitRank( const PostData& data )
 {
     auto ptr = data.hits;
-    float ramp = 1.f + 2.0f * float( data.hitnum ) / std::numeric_limits<uint8_t>::max();
-    float rank = LexiconHitRank( *ptr ) * ramp;
+    float rank = LexiconPostingRank( *ptr, data.hitnum );
     for( int i=1; i<data.hitnum; i++ ) assert( LexiconHitRank( *ptr++ ) <= rank );
     return rank;
 }
@@ -61,12 +84,57 @@ static float HitRankSimple( const PostData& data )
 
 static float PostRank( const PostData& data )
 {
-    return ( float( data.children ) / LexiconChildMax ) * 0.75f + 0.25f;
+    return LexiconChildRank( data.children );
+}
+
+// First post at or after ptr with postid >= id. Compares four posts at a time.
+static const PostData* Scan( const PostData* ptr, const PostData* end, uint32_t id )
+{
+#ifdef SEARCH_SIMD
+    static_assert( sizeof( PostData ) == 16, "Post data must fill a vector register" );
+    static const uint8_t Lower[16] = { 0, 1, 0, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 4 };
+    // Post ids are below 2^27, signed comparison is fine.
+    const auto key = _mm_set1_epi32( int( id ) );
+    while( end - ptr >= 4 )
+    {
+        const auto p01 = _mm_unpacklo_epi32( _mm_loadu_si128( (const __m128i*)ptr ), _mm_loadu_si128( (const __m128i*)( ptr+1 ) ) );
+        const auto p23 = _mm_unpacklo_epi32( _mm_loadu_si128( (const __m128i*)( ptr+2 ) ), _mm_loadu_si128( (const __m128i*)( ptr+3 ) ) );
+        const auto ids = _mm_unpacklo_epi64( p01, p23 );
+        const auto mask = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmplt_epi32( ids, key ) ) );
+        // Lists are sorted, so lanes below the key form a prefix.
+        if( mask != 0xF ) return ptr + Lower[mask];
+        ptr += 4;
+    }
+#endif
+    while( ptr != end && ptr->postid < id ) ptr++;
+    return ptr;
+}
+
+// Tracks the keep best ranks in a min-heap. Returns false if rank is lower
+// than all of them, i.e. the post won't be among the kept results. Without
+// a limit every post is kept, and nothing is tracked.
+static bool KeepRank( std::vector<float>& top, size_t keep, float rank )
+{
+    if( keep == SearchEngine::NoLimit ) return true;
+    if( top.size() < keep )
+    {
+        top.emplace_back( rank );
+        std::push_heap( top.begin(), top.end(), std::greater<float>() );
+        return true;
+    }
+    if( keep == 0 || rank < top.front() ) return false;
+    if( rank > top.front() )
+    {
+        std::pop_heap( top.begin(), top.end(), std::greater<float>() );
+        top.back() = rank;
+        std::push_heap( top.begin(), top.end(), std::greater<float>() );
+    }
+    return true;
 }
 
-static float GetWordDistance( const std::vector<const PostData*>& list1, const std::vector<const PostData*>& list2 )
+static float GetWordDistance( const PostData* const* list1, size_t size1, const PostData* const* list2, size_t size2 )
 {
-    assert( !list1.empty() && !list2.empty() );
+    assert( size1 != 0 && size2 != 0 );
 
     static thread_local int8_t start[NUM_LEXICON_TYPES][2];
     static thread_local std::vector<uint8_t> hop[NUM_LEXICON_TYPES][2];
@@ -80,15 +148,16 @@ static float GetWordDistance( const std::vector<const PostData*>& list1, const s
         }
     }
 
-    const std::vector<const PostData*>* list[] = { &list1, &list2 };
+    const PostData* const* list[] = { list1, list2 };
+    const size_t size[] = { size1, size2 };
 
     for( int i=0; i<2; i++ )
     {
         uint8_t data[256];
         int cnt = 0;
-        const auto& src = list[i];
-        for( auto& p : *src )
+        for( size_t k=0; k<size[i]; k++ )
         {
+            const auto p = list[i][k];
             for( int j=0; j<p->hitnum; j++ )
             {
                 auto pos = LexiconHitPos( p->hits[j] );
@@ -178,6 +247,214 @@ static float GetWordDistance( const std::vector<const PostData*>& list1, const s
     return min;
 }
 
+// Filtered searches, and words restricted to headers, only take posts with a hit of given type.
+static bool MatchesFilter( const uint8_t* hits, uint8_t hitnum, int filter, uint32_t wf )
+{
+    if( filter == T_All )
+    {
+        if( !( wf & ( WF_From | WF_Subject ) ) ) return true;
+        filter = ( wf & WF_From ) ? T_From : T_Subject;
+    }
+    for( int j=0; j<hitnum; j++ )
+    {
+        if( LexiconDecodeType( hits[j] ) == filter ) return true;
+    }
+    return false;
+}
+
+bool PostRestriction::Accepts( uint32_t postid ) const
+{
+    if( postid < postMin || postid > postMax ) return false;
+    if( filter->HasDate() )
+    {
+        const auto date = conn->Date( postid );
+        if( date == 0 || date < filter->dateFrom || ( filter->dateTo != 0 && date >= filter->dateTo ) ) return false;
+    }
+    if( filter->toplevel && conn->Parent( postid ) >= 0 ) return false;
+    if( filter->thread >= 0 && !thread.Has( postid ) ) return false;
+    if( !filter->author.empty() )
+    {
+        const auto from = archive->GetFrom( postid );
+        const auto end = from + strlen( from );
+        const auto& author = filter->author;
+        if( std::search( from, end, author.begin(), author.end(), [] ( char l, char r ) { return tolower( l ) == tolower( r ); } ) == end ) return false;
+    }
+    return true;
+}
+
+// Blocks of a posting list which may hold posts passing the restriction, as [first, end).
+static std::pair<uint32_t, uint32_t> BlockRange( const LexiconBlockInfo* blocks, uint32_t numBlocks, const PostRestriction& where )
+{
+    if( !where.active ) return std::make_pair( 0u, numBlocks );
+    if( where.postMin > where.postMax ) return std::make_pair( 0u, 0u );
+    const auto end = blocks + numBlocks;
+    const auto first = std::lower_bound( blocks, end, where.postMin, [] ( const LexiconBlockInfo& l, uint32_t r ) { return l.last < r; } );
+    auto last = std::lower_bound( first, end, where.postMax, [] ( const LexiconBlockInfo& l, uint32_t r ) { return l.last < r; } );
+    if( last != end ) last++;
+    return std::make_pair( uint32_t( first - blocks ), uint32_t( last - blocks ) );
+}
+
+// Postid of the last posting in block.
+static uint32_t BlockLast( const PostCursor& c, uint32_t block )
+{
+    if( c.blocks ) return c.blocks[block].last;
+    return c.data[std::min<uint32_t>( c.size, ( block + 1 ) * LexiconBlockSize ) - 1].postid & LexiconPostMask;
+}
+
+static void DecodeBlock( PostCursor& c, uint32_t block )
+{
+    const auto num = std::min<uint32_t>( LexiconBlockSize, c.size - block * LexiconBlockSize );
+    const auto& where = *c.where;
+    c.block = block;
+    c.pos = 0;
+    c.num = 0;
+    const auto Add = [&c, &where] ( uint32_t postid, uint8_t hitnum, uint8_t children, const uint8_t* hits ) {
+        if( MatchesFilter( hits, hitnum, c.filter, c.wf ) && ( !where.active || where.Accepts( postid ) ) )
+        {
+            c.post[c.num++] = PostData { postid, hitnum, children, hits };
+        }
+    };
+    if( c.blocks )
+    {
+        const auto data = (const uint8_t*)c.blocks + c.blocks[block].offset;
+        uint32_t postid[LexiconBlockSize];
+        LexiconDecodeBlock( data, block == 0 ? 0 : c.blocks[block-1].last, postid );
+        auto children = data + 4 + *data * 16;
+        auto hits = children + num;
+        for( uint32_t i=0; i<num; i++ )
+        {
+            const auto hitnum = *hits++;
+            Add( postid[i], hitnum, children[i], hits );
+            hits += hitnum;
+        }
+    }
+    else
+    {
+        auto data = c.data + block * LexiconBlockSize;
+        for( uint32_t i=0; i<num; i++ )
+        {
+            uint8_t children = data->postid >> LexiconChildShift;
+            uint8_t hitnum = data->hitoffset >> LexiconHitShift;
+            const uint8_t* hits;
+            if( hitnum == 0 )
+            {
+                hits = c.lexhit + ( data->hitoffset & LexiconHitOffsetMask );
+                hitnum = *hits++;
+            }
+            else
+            {
+                hits = (const uint8_t*)&data->hitoffset;
+            }
+            Add( data->postid & LexiconPostMask, hitnum, children, hits );
+            data++;
+        }
+    }
+}
+
+// Moves cursor to the first post with postid >= id. Blocks which end before
+// id are skipped without decoding.
+static void Seek( PostCursor& c, uint32_t id )
+{
+    for(;;)
+    {
+        c.pos = uint32_t( Scan( c.post + c.pos, c.post + c.num, id ) - c.post );
+        if( c.pos < c.num )
+        {
+            c.postid = c.post[c.pos].postid;
+            return;
+        }
+        auto b = c.block + 1;
+        while( b < c.numBlocks && BlockLast( c, b ) < id ) b++;
+        if( b >= c.numBlocks )
+        {
+            c.postid = PostCursorEnd;
+            return;
+        }
+        DecodeBlock( c, b );
+    }
+}
+
+static void Next( PostCursor& c )
+{
+    if( ++c.pos < c.num )
+    {
+        c.postid = c.post[c.pos].postid;
+    }
+    else
+    {
+        Seek( c, c.postid + 1 );
+    }
+}
+
+// Block of the cursor's list which may hold id, or numBlocks if the list ends before it.
+static uint32_t ShallowSeek( const PostCursor& c, uint32_t id )
+{
+    auto b = c.block;
+    while( b < c.numBlocks && BlockLast( c, b ) < id ) b++;
+    return b;
+}
+
+// Calls f( postid, match ) for each post which is in all of the must lists
+// and in none of the cant lists, in postid order. match[word] points to the
+// post in the list of given word. The shortest list drives the search, the
+// other ones are checked shortest first, skipping blocks which end before the
+// driving post. Cursors are consumed.
+template<class F>
+static void Intersect( std::vector<PostCursor*>& must, std::vector<PostCursor*>& cant, const PostData** match, F&& f )
+{
+    assert( !must.empty() );
+    std::sort( must.begin(), must.end(), [] ( const PostCursor* l, const PostCursor* r ) { return l->numBlocks - l->block < r->numBlocks - r->block; } );
+    auto& lead = *must[0];
+    while( lead.postid != PostCursorEnd )
+    {
+        const auto id = lead.postid;
+        match[lead.word] = lead.post + lead.pos;
+
+        size_t i;
+        for( i=1; i<must.size(); i++ )
+        {
+            auto& c = *must[i];
+            Seek( c, id );
+            if( c.postid == PostCursorEnd ) return;
+            if( c.postid != id ) break;
+            match[c.word] = c.post + c.pos;
+        }
+        if( i != must.size() )
+        {
+            // Skip the driving list to the next post that can possibly match.
+            Seek( lead, must[i]->postid );
+            continue;
+        }
+
+        bool excluded = false;
+        for( auto c : cant )
+        {
+            Seek( *c, id );
+            if( c->postid == id )
+            {
+                excluded = true;
+                break;
+            }
+        }
+        if( !excluded ) f( id, match );
+        Next( lead );
+    }
+}
+
+// Equal ranks are ordered by postid, so that any limit and offset cut the same order.
+static const auto ResultOrder = [] ( const SearchResult& l, const SearchResult& r ) {
+    return l.rank > r.rank || ( l.rank == r.rank && l.postid < r.postid );
+};
+
+// Results which can't get among the keep best are dropped, once there are
+// enough of them.
+static void Prune( std::vector<SearchResult>& result, size_t keep )
+{
+    if( result.size() < RankBatch || keep > result.size() / 2 ) return;
+    std::nth_element( result.begin(), result.begin() + keep, result.end(), ResultOrder );
+    result.resize( keep );
+}
+
 static SearchResult PrepareResults( uint32_t postid, float rank, int hitsize )
 {
     SearchResult ret;
@@ -189,18 +466,132 @@ static SearchResult PrepareResults( uint32_t postid, float rank, int hitsize )
     return ret;
 }
 
-uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const
+// Calls f( ptr, len ) for each word of text that would be indexed by lexicon.
+// ASCII text is split by lexicon's own rules. Lexicon splits runs holding
+// UTF-8 with ICU, which libuat doesn't link. Such a run is taken as a single
+// word here, trimmed of ASCII punctuation. Runs which ICU would split into
+// more words can't be matched, and case of non-ASCII letters is not folded.
+template<class F>
+static void ForEachWord( const char* ptr, const char* end, F&& f )
+{
+    SplitTextRuns( ptr, end, [&f] ( const char* begin, const char* end ) { SplitASCIIWords( begin, end, f ); }, [&f] ( const char* begin, const char* end ) {
+        while( begin < end && !( *begin & 0x80 ) && !WordIsAlnum( *begin ) ) begin++;
+        while( end > begin && !( end[-1] & 0x80 ) && !WordIsAlnum( end[-1] ) ) end--;
+        uint32_t len = 0;
+        for( auto p = begin; p < end; p++ ) if( ( *p & 0xC0 ) != 0x80 ) len++;
+        if( len >= LexiconMinLen && len <= LexiconMaxLen ) f( begin, uint32_t( end - begin ) );
+    } );
+}
+
+static bool HasHit( const PostData& post, uint8_t hit )
+{
+    return std::find( post.hits, post.hits + post.hitnum, hit ) != post.hits + post.hitnum;
+}
+
+// Has a hit of given type at pos or further.
+static bool HasHitAfter( const PostData& post, LexiconType type, int pos )
+{
+    for( int i=0; i<post.hitnum; i++ )
+    {
+        const auto hit = post.hits[i];
+        if( LexiconDecodeType( hit ) == type && ( hit & LexiconHitPosMask[type] ) >= pos ) return true;
+    }
+    return false;
+}
+
+enum class PhraseMatch
+{
+    None,
+    Maybe,      // hits can't tell, message text has to be checked
+    Exact
+};
+
+// Looks for a run of consecutive positions in hits of the phrase words. Hits
+// of the first word in the lexicon anchor the run. Positions past the
+// saturated maximum of a type are all stored as the maximum, there the run
+// can't be followed and only presence of the words is checked.
+static PhraseMatch MatchPhraseHits( const uint32_t* slots, uint32_t size, int type, const PostData* const* match )
+{
+    uint32_t anchor = 0;
+    while( slots[anchor] == PhraseGap ) anchor++;
+    assert( anchor < size );
+
+    // Hits past the first 255 of a post are not stored.
+    auto ret = PhraseMatch::None;
+    bool gap = false;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        if( slots[i] == PhraseGap ) gap = true;
+        else if( match[slots[i]]->hitnum == std::numeric_limits<uint8_t>::max() ) ret = PhraseMatch::Maybe;
+    }
+
+    const auto& lead = *match[slots[anchor]];
+    for( int h=0; h<lead.hitnum; h++ )
+    {
+        const auto hit = lead.hits[h];
+        const auto t = LexiconDecodeType( hit );
+        if( type != T_All && t != type ) continue;
+        const int max = LexiconHitPosMask[t];
+        const int pos = hit & max;
+
+        bool ok = true;
+        bool exact = !gap;
+        if( pos < max )
+        {
+            const int start = pos - int( anchor );
+            if( start < 0 ) continue;
+            for( uint32_t i=0; i<size && ok; i++ )
+            {
+                if( i == anchor || slots[i] == PhraseGap ) continue;
+                const int want = start + int( i );
+                if( want >= max ) exact = false;
+                ok = HasHit( *match[slots[i]], LexiconHitTypeEncoding[t] | std::min( want, max ) );
+            }
+        }
+        else
+        {
+            exact = false;
+            for( uint32_t i=0; i<size && ok; i++ )
+            {
+                if( i == anchor || slots[i] == PhraseGap ) continue;
+                ok = HasHitAfter( *match[slots[i]], t, std::max( 0, std::min( max, max - int( anchor ) + int( i ) ) ) );
+            }
+        }
+        if( ok )
+        {
+            if( exact ) return PhraseMatch::Exact;
+            ret = PhraseMatch::Maybe;
+        }
+    }
+    return ret;
+}
+
+uint32_t SearchEngine::ExtractWords( SearchContext& ctx, const std::vector<std::string>& terms, int flags ) const
 {
-    robin_hood::unordered_flat_set<uint32_t> wordset;
+    auto& wordset = ctx.m_wordset;
+    auto& words = ctx.m_words;
+    auto& matched = ctx.m_data.matched;
+    auto& processed = ctx.m_processed;
+
+    wordset.Reset( m_archive.m_lexmeta->DataSize() );
+    words.clear();
+    matched.clear();
+    ctx.m_phrases.clear();
+    ctx.m_negated.clear();
+    ctx.m_phraseSlots.clear();
+    ctx.m_phraseText.clear();
+    ctx.m_fuzzy.clear();
+
     uint32_t group = 0;
-    words.reserve( terms.size() );
-    for( auto& v : terms )
+    for( size_t t=0; t<terms.size(); t++ )
     {
+        auto& v = terms[t];
         uint32_t wf = WF_None;
         const char* str = v.c_str();
         const char* strend = str + v.size();
         bool strictMatch = false;
-        bool matchAll = false;
+        bool wildcard = false;
+        int dist = -1;
         if( flags & SF_SetLogic )
         {
             if( strend - str > 1 )
@@ -234,6 +625,24 @@ uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int
                     }
                 }
             }
+            if( str != strend && *str != '"' )
+            {
+                if( strend - str > 2 && *(strend-2) == '~' && *(strend-1) >= '0' && *(strend-1) <= '9' )
+                {
+                    dist = std::min<int>( FuzzyMaxDistance, *(strend-1) - '0' );
+                    strend -= 2;
+                }
+                else if( strend - str > 1 && *(strend-1) == '~' )
+                {
+                    dist = FuzzyMaxDistance;
+                    strend--;
+                }
+            }
+            if( str != strend && *str == '"' && ( strend - str < 2 || *(strend-1) != '"' || std::find( str, strend, ' ' ) != strend ) )
+            {
+                t = ExtractPhrase( ctx, terms, t, str, strend, wf, group );
+                continue;
+            }
             if( strend - str > 2 && *str == '"' && *(strend-1) == '"' )
             {
                 str++;
@@ -242,633 +651,1268 @@ uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int
             }
             if( !( wf & ( WF_Must | WF_Cant ) ) )
             {
-                if( *(strend-1) == '*' )
-                {
-                    matchAll = true;
-                    strend--;
-                }
+                wildcard = std::find( str, strend, '*' ) != strend;
             }
         }
 
-        std::vector<std::string> processed;
-        if( !matchAll )
+        processed.clear();
+        if( !wildcard )
         {
-            processed.emplace_back( str, strend );
+            ctx.m_word.assign( str, strend );
+            auto res = m_archive.m_lexhash->Search( ctx.m_word.c_str() );
+            if( res >= 0 ) processed.emplace_back( res );
         }
         else
         {
-            auto& meta = m_archive.m_lexmeta;
-            auto& data = m_archive.m_lexstr;
-            const auto dataSize = meta.DataSize();
-            for( uint32_t i=0; i<dataSize; i++ )
-            {
-                auto mp = meta + i;
-                auto s = data + mp->str;
-                if( strncmp( s, str, strend - str ) == 0 )
-                {
-                    processed.emplace_back( s );
-                }
-            }
+            m_archive.m_lexdict->Match( str, strend - str, processed );
         }
 
+        const uint32_t first = words.size();
         bool added = false;
-        for( auto& word : processed )
+        for( auto& res : processed )
         {
-            auto res = m_archive.m_lexhash.Search( word.c_str() );
-            if( res >= 0 && wordset.find( res ) == wordset.end() )
+            if( !wordset.Has( res ) )
             {
-                words.emplace_back( WordData { uint32_t( res ), 1.f, wf, group, strictMatch } );
-                wordset.emplace( res );
-                matched.emplace_back( m_archive.m_lexstr + m_archive.m_lexmeta[res].str );
+                words.emplace_back( WordData { res, 1.f, wf, group, strictMatch } );
+                wordset.Set( res, 1 );
+                matched.emplace_back( *m_archive.m_lexstr + (*m_archive.m_lexmeta)[res].str );
                 added = true;
             }
         }
 
-        if( added ) group++;
+        // Terms extended with similar words get a group, even if they have
+        // no words of their own.
+        bool fuzzy = false;
+        if( flags & SF_FuzzySearch && !strictMatch && dist != 0 && ( added || ( processed.empty() && !wildcard ) ) )
+        {
+            ctx.m_fuzzy.emplace_back( SearchContext::FuzzyTerm { uint32_t( t ), uint32_t( str - v.c_str() ), uint32_t( strend - v.c_str() ), first, uint32_t( words.size() ), group, wf, dist, wildcard } );
+            fuzzy = true;
+        }
+
+        if( added || fuzzy ) group++;
     }
 
-    if( flags & SF_FuzzySearch )
+    // Similar words are added after all exact ones, so that a word given
+    // in the query is never taken as a typo of another term.
+    bool empty = false;
+    for( auto& f : ctx.m_fuzzy )
     {
-        const auto sz = words.size();
-        for( int i=0; i<sz; i++ )
+        if( f.dist < 0 && f.first != f.last && m_archive.HasLexDist() )
         {
-            const auto& wd = words[i];
-            const auto flags = wd.flags;
-            const auto group = wd.group;
-
-            if( !wd.strict && !( flags & ( WF_Must | WF_Cant ) ) )
+            for( uint32_t i=f.first; i<f.last; i++ )
             {
-                auto ptr = (*m_archive.m_lexdist)[wd.word];
+                auto ptr = (*m_archive.m_lexdist)[words[i].word];
                 const auto size = *ptr++;
-                for( uint32_t i=0; i<size; i++ )
+                for( uint32_t j=0; j<size; j++ )
                 {
                     const auto data = *ptr++;
                     const auto offset = data & 0x3FFFFFFF;
-                    auto word = m_archive.m_lexstr + offset;
-                    auto res2 = m_archive.m_lexhash.Search( word );
+                    auto word = *m_archive.m_lexstr + offset;
+                    auto res2 = m_archive.m_lexhash->Search( word );
                     assert( res2 >= 0 );
                     // todo: check if distance modifier is higher than already stored one
-                    if( wordset.find( res2 ) == wordset.end() )
+                    if( !wordset.Has( res2 ) )
                     {
-                        wordset.emplace( res2 );
+                        wordset.Set( res2, 1 );
                         const auto dist = data >> 30;
                         assert( dist > 0 && dist <= 3 );
-                        static const float DistMod[] = { 0.f, 0.01f, 0.001f, 0.0001f };
-                        words.emplace_back( WordData { uint32_t( res2 ), DistMod[dist], flags, group, false } );
+                        words.emplace_back( WordData { uint32_t( res2 ), FuzzyDistMod[dist], f.wf, f.group, false } );
                         matched.emplace_back( word );
                     }
                 }
             }
         }
+        else if( !f.wildcard && !ExtendFuzzy( ctx, terms[f.term], f ) && f.first == f.last )
+        {
+            empty = true;
+        }
+    }
+
+    // Groups of unknown terms which found no similar words are left out,
+    // keeping the others in query order.
+    if( empty )
+    {
+        auto& remap = ctx.m_processed;
+        remap.assign( group + 1, 0 );
+        for( auto& w : words ) if( !( w.flags & WF_Negated ) ) remap[w.group] = 1;
+        uint32_t num = 0;
+        for( auto& v : remap )
+        {
+            const auto used = v;
+            v = num;
+            num += used;
+        }
+        for( auto& w : words ) w.group = remap[w.group];
+        group = num;
     }
 
     return group;
 }
 
-std::vector<SearchEngine::PostDataVec> SearchEngine::GetPostsForWords( const std::vector<WordData>& words, int filter ) const
+// Looks up words similar to the term in the sorted dictionary. Returns
+// true if any of them were added to the searched words.
+bool SearchEngine::ExtendFuzzy( SearchContext& ctx, const std::string& term, const SearchContext::FuzzyTerm& f ) const
 {
-    std::vector<PostDataVec> wdata;
-    wdata.reserve( words.size() );
+    auto& similar = ctx.m_similar;
+    auto& wordset = ctx.m_wordset;
+    const auto& meta = *m_archive.m_lexmeta;
 
-    for( int w=0; w<words.size(); w++ )
+    ctx.m_word.assign( term.begin() + f.begin, term.begin() + f.end );
+    int dist = f.dist;
+    if( dist < 0 )
     {
-        const auto v = words[w].word;
-        const auto wf = words[w].flags;
+        const auto len = std::count_if( ctx.m_word.begin(), ctx.m_word.end(), [] ( char c ) { return ( c & 0xC0 ) != 0x80; } );
+        dist = len <= 5 ? 1 : FuzzyMaxDistance;
+    }
 
-        auto meta = m_archive.m_lexmeta[v];
-        auto data = m_archive.m_lexdata + ( meta.data / sizeof( LexiconDataPacket ) );
+    similar.clear();
+    m_archive.m_lexdict->Similar( ctx.m_word.c_str(), dist, similar );
+    const auto size = std::min<size_t>( FuzzyMaxWords, similar.size() );
+    std::partial_sort( similar.begin(), similar.begin() + size, similar.end(), [&meta] ( const std::pair<uint32_t, uint32_t>& l, const std::pair<uint32_t, uint32_t>& r ) {
+        if( l.second != r.second ) return l.second < r.second;
+        if( meta[l.first].dataSize != meta[r.first].dataSize ) return meta[l.first].dataSize > meta[r.first].dataSize;
+        return l.first < r.first;
+    } );
+
+    bool added = false;
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto word = similar[i].first;
+        if( similar[i].second == 0 || wordset.Has( word ) ) continue;
+        wordset.Set( word, 1 );
+        ctx.m_words.emplace_back( WordData { word, FuzzyDistMod[similar[i].second], f.wf, f.group, false } );
+        ctx.m_data.matched.emplace_back( *m_archive.m_lexstr + meta[word].str );
+        added = true;
+    }
+    return added;
+}
 
-        const auto allocSize = meta.dataSize;
-        if( allocSize * sizeof( PostData ) > SlabSize )
+// Words of a quoted phrase, which may span any number of terms, are all
+// required. Phrase words which are not in the lexicon are kept as gaps, to
+// be checked in the message text. Posts holding a negated phrase are
+// excluded. Its words get lists of their own, even if they are searched for
+// too, as these are read in a different order. Returns index of the last term
+// of the phrase.
+size_t SearchEngine::ExtractPhrase( SearchContext& ctx, const std::vector<std::string>& terms, size_t idx, const char* str, const char* strend, uint32_t wf, uint32_t& group ) const
+{
+    auto& wordset = ctx.m_wordset;
+    auto& words = ctx.m_words;
+    auto& slots = ctx.m_phraseSlots;
+    auto& text = ctx.m_phraseText;
+
+    const bool negated = wf & WF_Cant;
+    const uint32_t first = slots.size();
+    str++;
+    for(;;)
+    {
+        bool last = idx == terms.size() - 1;
+        if( strend > str && *(strend-1) == '"' )
         {
-            wdata.emplace_back( 0, nullptr );
-            continue;
+            strend--;
+            last = true;
         }
-        auto pdata = (PostData*)slab.Alloc( sizeof( PostData ) * allocSize );
-        auto ptr = pdata;
+        bool added = false;
+        ForEachWord( str, strend, [&] ( const char* ptr, uint32_t len ) {
+            auto& word = ctx.m_word;
+            word.assign( ptr, len );
+            text.emplace_back( word );
 
-        for( uint32_t i=0; i<meta.dataSize; i++ )
-        {
-            uint8_t children = data->postid >> LexiconChildShift;
-            uint8_t hitnum = data->hitoffset >> LexiconHitShift;
-            const uint8_t* hits;
-            if( hitnum == 0 )
+            const auto res = m_archive.m_lexhash->Search( word.c_str() );
+            if( res < 0 )
             {
-                hits = m_archive.m_lexhit + ( data->hitoffset & LexiconHitOffsetMask );
-                hitnum = *hits++;
-            }
-            else
-            {
-                hits = (const uint8_t*)&data->hitoffset;
+                slots.emplace_back( PhraseGap );
+                return;
             }
-            if( filter != T_All )
+            if( negated )
             {
-                for( int j=0; j<hitnum; j++ )
-                {
-                    if( LexiconDecodeType( hits[j] ) == filter )
-                    {
-                        *ptr++ = PostData { data->postid & LexiconPostMask, hitnum, children, hits };
-                        break;
-                    }
-                }
+                slots.emplace_back( uint32_t( words.size() ) );
+                words.emplace_back( WordData { uint32_t( res ), 1.f, ( wf & ~WF_Cant ) | WF_Negated, group, true } );
             }
-            else if( wf & ( WF_From | WF_Subject ) )
+            else if( !wordset.Has( res ) )
             {
-                const LexiconType type = ( wf & WF_From ) ? T_From : T_Subject;
-                for( int j=0; j<hitnum; j++ )
-                {
-                    if( LexiconDecodeType( hits[j] ) == type )
-                    {
-                        *ptr++ = PostData { data->postid & LexiconPostMask, hitnum, children, hits };
-                        break;
-                    }
-                }
+                slots.emplace_back( uint32_t( words.size() ) );
+                words.emplace_back( WordData { uint32_t( res ), 1.f, wf | WF_Must, group, true } );
+                wordset.Set( res, 1 );
+                ctx.m_data.matched.emplace_back( *m_archive.m_lexstr + (*m_archive.m_lexmeta)[res].str );
+                added = true;
             }
             else
             {
-                *ptr++ = PostData { data->postid & LexiconPostMask, hitnum, children, hits };
+                const auto it = std::find_if( words.begin(), words.end(), [res] ( const auto& w ) { return w.word == uint32_t( res ) && !( w.flags & WF_Negated ); } );
+                assert( it != words.end() );
+                it->flags = it->flags | WF_Must;
+                slots.emplace_back( uint32_t( it - words.begin() ) );
             }
-            data++;
-        }
-
-        const auto psize = ptr - pdata;
-        assert( psize <= allocSize );
-        if( psize != allocSize )
-        {
-            slab.Unalloc( sizeof( PostData ) * ( allocSize - psize ) );
-        }
-        wdata.emplace_back( psize, pdata );
+        } );
+        if( added ) group++;
+        if( last ) break;
+        auto& v = terms[++idx];
+        str = v.c_str();
+        strend = str + v.size();
     }
 
-    return wdata;
+    // A phrase made of a single lexicon word is just a required word, or a
+    // cant word, if negated. Words not in the lexicon are in no message, so
+    // a negated phrase of these only excludes nothing.
+    const uint32_t size = slots.size() - first;
+    const auto known = size - std::count( slots.begin() + first, slots.end(), PhraseGap );
+    if( known == 0 || size == 1 )
+    {
+        if( negated && known == 1 ) words.back().flags = ( words.back().flags & ~WF_Negated ) | WF_Cant;
+        slots.resize( first );
+        text.resize( first );
+    }
+    else
+    {
+        const int type = ( wf & WF_From ) ? int( T_From ) : ( ( wf & WF_Subject ) ? int( T_Subject ) : int( T_All ) );
+        ( negated ? ctx.m_negated : ctx.m_phrases ).emplace_back( SearchContext::Phrase { first, size, type } );
+    }
+    return idx;
 }
 
-int SearchEngine::FixupFlags( int flags ) const
+bool SearchEngine::MatchPhrases( SearchContext& ctx, uint32_t postid, const PostData* const* match ) const
 {
-    if( flags & SF_FuzzySearch )
+    for( auto& phrase : ctx.m_phrases )
     {
-        if( m_archive.m_lexdist )
-        {
-            flags &= ~SF_RequireAllWords;
-        }
-        else
-        {
-            flags &= ~SF_FuzzySearch;
-        }
+        const auto res = MatchPhraseHits( ctx.m_phraseSlots.data() + phrase.first, phrase.size, phrase.type, match );
+        if( res == PhraseMatch::None ) return false;
+        if( res == PhraseMatch::Maybe && !VerifyPhrase( ctx, postid, phrase ) ) return false;
     }
-    if( flags & SF_RequireAllWords )
+    return true;
+}
+
+// Checks if the post holds the phrase, reading lists of its words up to the
+// post. Lists only move forward, so posts have to be checked in postid order.
+bool SearchEngine::HasPhrase( SearchContext& ctx, const SearchContext::Phrase& phrase, uint32_t postid ) const
+{
+    const auto slots = ctx.m_phraseSlots.data() + phrase.first;
+    const auto match = ctx.m_match.data();
+    for( uint32_t i=0; i<phrase.size; i++ )
     {
-        flags &= ~SF_SetLogic;
+        if( slots[i] == PhraseGap ) continue;
+        auto& c = ctx.m_cursors[slots[i]];
+        if( c.postid < postid ) Seek( c, postid );
+        if( c.postid != postid ) return false;
+        match[slots[i]] = c.post + c.pos;
     }
-    return flags;
+    const auto res = MatchPhraseHits( slots, phrase.size, phrase.type, match );
+    return res == PhraseMatch::Exact || ( res == PhraseMatch::Maybe && VerifyPhrase( ctx, postid, phrase ) );
 }
 
-std::vector<SearchResult> SearchEngine::GetSingleResult( const std::vector<SearchEngine::PostDataVec>& wdata, int flags ) const
+bool SearchEngine::HasNegated( SearchContext& ctx, uint32_t postid ) const
 {
-    std::vector<SearchResult> result;
-
-    assert( wdata.size() == 1 );
-
-    const auto size = wdata[0].first;
-    auto ptr = wdata[0].second;
-    auto end = ptr + size;
-    result.reserve( size );
-    while( ptr != end )
+    for( auto& phrase : ctx.m_negated )
     {
-        // hits are already sorted
-        if( flags & SF_SimpleSearch )
-        {
-            result.emplace_back( PrepareResults( ptr->postid, HitRankSimple( *ptr ), ptr->hitnum ) );
-        }
-        else
-        {
-            result.emplace_back( PrepareResults( ptr->postid, PostRank( *ptr ) * HitRank( *ptr ), ptr->hitnum ) );
-        }
-        auto& sr = result.back();
-        memcpy( sr.hits, ptr->hits, sr.hitnum );
-        memset( sr.words, 0, sr.hitnum * sizeof( uint32_t ) );
-        ptr++;
+        if( HasPhrase( ctx, phrase, postid ) ) return true;
     }
-
-    return result;
+    return false;
 }
 
-std::vector<SearchResult> SearchEngine::GetAllWordResult( const std::vector<SearchEngine::PostDataVec>& wdata, int flags, uint32_t groups, uint32_t missing ) const
+// Looks for the phrase in words of the message, which are split by
+// ForEachWord and typed the same way lexicon does it. Words of body lines of one type are a single
+// run, like hit positions are. Only the first PhraseVerifyBytes of the
+// message are checked.
+bool SearchEngine::VerifyPhrase( SearchContext& ctx, uint32_t postid, const SearchContext::Phrase& phrase ) const
 {
-    assert( !( flags & SF_FuzzySearch ) );
-
-    std::vector<SearchResult> result;
-    const auto wsize = wdata.size();
+    const auto msg = m_archive.GetMessagePart( postid, ctx.m_eb, PhraseVerifyBytes, ZMessageView::NoLimit );
+    if( !msg ) return false;
 
-    std::vector<const PostData*> list;
-    list.reserve( 32 );
-    result.reserve( wdata[0].first );
-
-    auto& vec = *wdata.begin();
-    for( int i=0; i<vec.first; i++ )
-    {
-        auto& post = vec.second[i];
-        list.clear();
-        list.emplace_back( &post );
-        bool ok = true;
-        for( size_t i=1; i<wsize; i++ )
+    const auto text = ctx.m_phraseText.data() + phrase.first;
+    const auto size = phrase.size;
+    auto Find = [text, size] ( const std::vector<std::pair<const char*, uint32_t>>& tokens ) {
+        for( size_t i=0; i+size<=tokens.size(); i++ )
         {
-            auto& vtest = wdata[i];
-            auto begin = vtest.second;
-            auto end = begin + vtest.first;
-            auto it = std::lower_bound( begin, end, post, [] ( const auto& l, const auto& r ) { return l.postid < r.postid; } );
-            if( it == end || it->postid != post.postid )
-            {
-                ok = false;
-                break;
-            }
-            else
+            uint32_t j;
+            for( j=0; j<size; j++ )
             {
-                list.emplace_back( &*it );
+                const auto& tok = tokens[i+j];
+                if( tok.second != text[j].size() || strnicmpl( tok.first, text[j].c_str(), tok.second ) != 0 ) break;
             }
+            if( j == size ) return true;
         }
-        if( ok )
-        {
-            assert( groups == list.size() );
-            float rank = 0;
-            if( flags & SF_SimpleSearch )
-            {
-                for( auto& v : list )
-                {
-                    rank += HitRankSimple( *v );
-                }
-            }
-            else
+        return false;
+    };
+    auto Wanted = [&phrase] ( int type ) { return phrase.type == T_All || phrase.type == type; };
+
+    auto ptr = msg;
+    while( *ptr != '\0' && *ptr != '\n' )
+    {
+        auto end = ptr;
+        while( *end != '\0' && *end != '\n' ) end++;
+        int type = -1;
+        if( strnicmpl( ptr, "from: ", 6 ) == 0 ) type = T_From;
+        else if( strnicmpl( ptr, "subject: ", 9 ) == 0 ) type = T_Subject;
+        if( type >= 0 && Wanted( type ) )
+        {
+            auto& tokens = ctx.m_tokens[type];
+            tokens.clear();
+            ForEachWord( ptr + ( type == T_From ? 6 : 9 ), end, [&tokens] ( const char* ptr, uint32_t len ) { tokens.emplace_back( ptr, len ); } );
+            if( Find( tokens ) ) return true;
+        }
+        ptr = *end == '\n' ? end+1 : end;
+    }
+    if( phrase.type == T_From || phrase.type == T_Subject ) return false;
+
+    for( auto& v : ctx.m_tokens ) v.clear();
+    while( *ptr == '\n' ) ptr++;
+    int wrote = DetectWrote( ptr );
+    bool signature = false;
+    for(;;)
+    {
+        auto line = ptr;
+        auto end = ptr;
+        while( *end != '\n' && *end != '\0' ) end++;
+        int quotLevel = 0;
+        if( end - line == 4 && strncmp( line, "-- ", 3 ) == 0 )
+        {
+            signature = true;
+        }
+        else
+        {
+            quotLevel = QuotationLevel( line, end );
+        }
+        if( line != end )
+        {
+            LexiconType t;
+            if( signature )
             {
-                for( auto& v : list )
-                {
-                    rank += HitRank( *v );
-                }
+                t = T_Signature;
             }
-            if( flags & SF_AdjacentWords )
+            else if( wrote > 0 )
             {
-                int drank = 127 * missing;
-                for( int g=0; g<groups-1; g++ )
-                {
-                    drank += GetWordDistance( std::vector<const PostData*> { list[g] }, std::vector<const PostData*> { list[g+1] } );
-                }
-                assert( drank != 0 );
-                rank /= drank;
+                t = T_Wrote;
+                wrote--;
             }
-            // only used in threadify, no need to output hit data
-            if( flags & SF_SimpleSearch )
+            else
             {
-                result.emplace_back( PrepareResults( post.postid, rank, 0 ) );
+                t = LexiconTypeFromQuotLevel( quotLevel );
             }
-            else
+            if( Wanted( t ) )
             {
-                result.emplace_back( PrepareResults( post.postid, rank * PostRank( post ), 0 ) );
+                auto& tokens = ctx.m_tokens[t];
+                ForEachWord( line, end, [&tokens] ( const char* ptr, uint32_t len ) { tokens.emplace_back( ptr, len ); } );
             }
         }
+        if( *end == '\0' ) break;
+        ptr = end + 1;
+    }
+    for( auto& v : ctx.m_tokens )
+    {
+        if( Find( v ) ) return true;
+    }
+    return false;
+}
+
+// Resolves the filter, narrowing the range of postids which can pass it.
+// Date range is looked up in the time index and a thread is collected from
+// the thread structure, so both cost as much as the posts they hold.
+void SearchEngine::Restrict( SearchContext& ctx, const SearchFilter& where ) const
+{
+    auto& r = ctx.m_where;
+    r.active = !where.Empty();
+    if( !r.active ) return;
+
+    const auto size = uint32_t( m_archive.NumberOfMessages() );
+    r.filter = &where;
+    r.archive = &m_archive;
+    r.conn = &*m_archive.m_connectivity;
+    r.postMin = 0;
+    r.postMax = size - 1;
+
+    const auto Narrow = [&r] ( uint32_t lo, uint32_t hi ) {
+        r.postMin = std::max( r.postMin, lo );
+        r.postMax = std::min( r.postMax, hi );
+    };
+    const auto Empty = [&r] {
+        r.postMin = 1;
+        r.postMax = 0;
+    };
+    if( size == 0 ) return Empty();
+
+    if( where.HasDate() )
+    {
+        const auto range = m_archive.m_timeidx->Range( where.dateFrom, where.dateTo == 0 ? std::numeric_limits<uint32_t>::max() : where.dateTo );
+        if( range.first == range.second ) return Empty();
+        const auto mm = std::minmax_element( range.first, range.second );
+        Narrow( *mm.first, *mm.second );
+    }
+    if( where.thread >= 0 )
+    {
+        if( uint32_t( where.thread ) >= size ) return Empty();
+        r.thread.Reset( size );
+        uint32_t lo = where.thread;
+        uint32_t hi = where.thread;
+        auto& stack = ctx.m_stack;
+        stack.clear();
+        stack.emplace_back( where.thread );
+        while( !stack.empty() )
+        {
+            const auto idx = stack.back();
+            stack.pop_back();
+            r.thread.Set( idx, 1 );
+            lo = std::min( lo, idx );
+            hi = std::max( hi, idx );
+            const auto children = r.conn->Children( idx );
+            stack.insert( stack.end(), children, children + r.conn->ChildrenCount( idx ) );
+        }
+        Narrow( lo, hi );
+    }
+}
+
+// Positions cursor at the first post of word's list which passes the filters.
+void SearchEngine::OpenCursor( const SearchContext& ctx, PostCursor& c, uint32_t word, int filter ) const
+{
+    const auto& wd = ctx.m_words[word];
+    const auto& where = ctx.m_where;
+    const auto meta = (*m_archive.m_lexmeta)[wd.word];
+
+    c.where = &where;
+    c.filter = filter;
+    c.word = word;
+    c.wf = wd.flags;
+    c.mod = wd.mod;
+    c.max = 0;
+    c.pos = 0;
+    c.num = 0;
+    if( m_archive.m_hasLexpost )
+    {
+        c.blocks = m_archive.m_lexpost->Blocks( wd.word );
+        c.data = nullptr;
+        c.lexhit = nullptr;
+        c.size = meta.dataSize;
+        const auto range = BlockRange( c.blocks, LexiconBlockCount( c.size ), where );
+        c.block = range.first;
+        c.numBlocks = range.second;
+    }
+    else
+    {
+        auto data = *m_archive.m_lexdata + ( meta.data / sizeof( LexiconDataPacket ) );
+        auto end = data + meta.dataSize;
+        if( where.active )
+        {
+            const auto Less = [] ( const LexiconDataPacket& l, uint32_t r ) { return ( l.postid & LexiconPostMask ) < r; };
+            data = std::lower_bound( data, end, where.postMin, Less );
+            end = std::lower_bound( data, end, where.postMax + 1, Less );
+        }
+        c.blocks = nullptr;
+        c.data = data;
+        c.lexhit = *m_archive.m_lexhit;
+        c.size = uint32_t( end - data );
+        c.block = 0;
+        c.numBlocks = LexiconBlockCount( c.size );
+    }
+
+    if( c.block == c.numBlocks )
+    {
+        c.postid = PostCursorEnd;
+        return;
+    }
+    DecodeBlock( c, c.block );
+    Seek( c, 0 );
+}
+
+void SearchEngine::OpenCursors( SearchContext& ctx, int filter ) const
+{
+    const auto size = ctx.m_words.size();
+    auto& cursors = ctx.m_cursors;
+    if( cursors.size() < size ) cursors.resize( size );
+    for( uint32_t w=0; w<size; w++ ) OpenCursor( ctx, cursors[w], w, filter );
+}
+
+int SearchEngine::FixupFlags( int flags ) const
+{
+    if( flags & SF_FuzzySearch )
+    {
+        flags &= ~SF_RequireAllWords;
+    }
+    if( flags & SF_RequireAllWords )
+    {
+        flags &= ~SF_SetLogic;
+    }
+    return flags;
+}
+
+// Grouped searches fold each batch of results into their threads, others
+// drop results which can't make it.
+void SearchEngine::Collect( SearchContext& ctx, int flags, size_t keep ) const
+{
+    if( !( flags & SF_GroupThreads ) )
+    {
+        Prune( ctx.m_data.results, keep );
+    }
+    else if( ctx.m_data.results.size() >= RankBatch )
+    {
+        FoldThreads( ctx );
+    }
+}
+
+// Adds results to the ranks of their threads, and clears them.
+void SearchEngine::FoldThreads( SearchContext& ctx ) const
+{
+    auto& result = ctx.m_data.results;
+    auto& threads = ctx.m_threads;
+    auto& slot = ctx.m_threadSlot;
+    const auto& conn = *m_archive.m_connectivity;
+    for( auto& v : result )
+    {
+        const auto root = conn.Root( v.postid );
+        if( slot.Has( root ) )
+        {
+            auto& t = threads[slot[root]];
+            t.sum += v.rank;
+            t.count++;
+            if( ResultOrder( v, t.best ) ) t.best = v;
+        }
+        else
+        {
+            slot.Set( root, uint32_t( threads.size() ) );
+            threads.emplace_back( SearchContext::ThreadRank { v, v.rank, 1 } );
+        }
     }
+    result.clear();
+}
 
-    return result;
+void SearchEngine::GetSingleResult( SearchContext& ctx, int flags, size_t keep ) const
+{
+    auto& c = ctx.m_cursors[0];
+    auto& result = ctx.m_data.results;
+
+    assert( ctx.m_words.size() == 1 );
+
+    size_t total = 0;
+    while( c.postid != PostCursorEnd )
+    {
+        const auto& post = c.post[c.pos];
+        // hits are already sorted
+        if( flags & SF_SimpleSearch )
+        {
+            result.emplace_back( PrepareResults( post.postid, HitRankSimple( post ), post.hitnum ) );
+        }
+        else
+        {
+            result.emplace_back( PrepareResults( post.postid, PostRank( post ) * HitRank( post ), post.hitnum ) );
+        }
+        auto& sr = result.back();
+        memcpy( sr.hits, post.hits, sr.hitnum );
+        memset( sr.words, 0, sr.hitnum * sizeof( uint32_t ) );
+        Collect( ctx, flags, keep );
+        total++;
+        Next( c );
+    }
+    ctx.m_data.total = total;
 }
 
-std::vector<SearchResult> SearchEngine::GetFullResult( const std::vector<SearchEngine::PostDataVec>& wdata, const std::vector<WordData>& words, int flags, uint32_t groups, uint32_t missing ) const
+void SearchEngine::GetAllWordResult( SearchContext& ctx, int flags, uint32_t groups, uint32_t missing, size_t keep ) const
 {
-    std::vector<SearchResult> result;
-    const auto wsize = std::min<size_t>( 1024, wdata.size() );
+    assert( !( flags & SF_FuzzySearch ) );
 
-    bool checkInclude = false;
-    robin_hood::unordered_flat_set<uint32_t> include;
-    if( flags & SF_SetLogic )
+    auto& result = ctx.m_data.results;
+    const auto wsize = ctx.m_words.size();
+
+    auto& must = ctx.m_must;
+    auto& cant = ctx.m_cant;
+    must.clear();
+    cant.clear();
+    for( size_t i=0; i<wsize; i++ )
     {
-        bool hasMust = false;
-        bool hasCant = false;
+        must.emplace_back( &ctx.m_cursors[i] );
+    }
+    ctx.m_match.resize( wsize );
 
-        for( auto& word : words )
+    assert( groups == wsize );
+    size_t total = 0;
+    Intersect( must, cant, ctx.m_match.data(), [&] ( uint32_t postid, const PostData** list ) {
+        float rank = 0;
+        if( flags & SF_SimpleSearch )
+        {
+            for( size_t i=0; i<wsize; i++ )
+            {
+                rank += HitRankSimple( *list[i] );
+            }
+        }
+        else
+        {
+            for( size_t i=0; i<wsize; i++ )
+            {
+                rank += HitRank( *list[i] );
+            }
+        }
+        if( flags & SF_AdjacentWords )
         {
-            auto flag = word.flags;
-            if( flag & ( WF_Must | WF_Cant ) )
+            int drank = 127 * missing;
+            for( int g=0; g<groups-1; g++ )
             {
-                checkInclude = true;
+                drank += GetWordDistance( &list[g], 1, &list[g+1], 1 );
+            }
+            assert( drank != 0 );
+            rank /= drank;
+        }
+        // only used in threadify, no need to output hit data
+        if( flags & SF_SimpleSearch )
+        {
+            result.emplace_back( PrepareResults( postid, rank, 0 ) );
+        }
+        else
+        {
+            result.emplace_back( PrepareResults( postid, rank * PostRank( *list[0] ), 0 ) );
+        }
+        Collect( ctx, flags, keep );
+        total++;
+    } );
+    ctx.m_data.total = total;
+}
 
-                if( flag & WF_Must )
-                {
-                    hasMust = true;
-                }
-                else
+// Ranks a post from its postings, given in word order. Returns false if the
+// post didn't get to the keep best ranks seen by scratch, its hit data is then
+// not filled.
+bool SearchEngine::RankPost( const SearchContext& ctx, SearchContext::Scratch& scratch, uint32_t postid, const SearchContext::Posts* posts, uint32_t num, int flags, uint32_t groups, uint32_t missing, size_t keep, SearchResult& sr ) const
+{
+    const auto& words = ctx.m_words;
+    auto& list1 = scratch.list1;
+    auto& list2 = scratch.list2;
+    auto& hits = scratch.hits;
+    auto& wordlist = scratch.wordlist;
+    auto& idx = scratch.idx;
+
+    hits.clear();
+    wordlist.clear();
+    idx.clear();
+
+    float rank = 0;
+    for( int m=0; m<num; m++ )
+    {
+        auto& v = posts[m];
+        if( flags & SF_SimpleSearch )
+        {
+            rank += HitRankSimple( v.data ) * words[v.word].mod;
+        }
+        else
+        {
+            rank += HitRank( v.data ) * words[v.word].mod;
+        }
+    }
+    if( flags & SF_AdjacentWords && groups > 1 )
+    {
+        int drank = 127 * missing;
+        list1.clear();
+        int g;
+        for( g = 0; g < groups-1; g++ )
+        {
+            for( int m=0; m<num; m++ )
+            {
+                auto& v = posts[m];
+                if( words[v.word].group == g )
                 {
-                    hasCant = true;
+                    list1.emplace_back( &v.data );
                 }
             }
+            if( !list1.empty() )
+            {
+                g++;
+                break;
+            }
+            drank += 127;
         }
-        if( checkInclude )
+        if( !list1.empty() )
         {
-            if( hasMust )
+            for( ; g<groups; g++ )
             {
-                int i;
-                for( i=0; i<wdata.size(); i++ )
+                list2.clear();
+                for( int m=0; m<num; m++ )
                 {
-                    if( words[i].flags & WF_Must )
+                    auto& v = posts[m];
+                    if( words[v.word].group == g )
                     {
-                        for( int j=0; j<wdata[i].first; j++ )
-                        {
-                            auto& v = wdata[i].second[j];
-                            include.emplace( v.postid );
-                        }
-                        break;
+                        list2.emplace_back( &v.data );
                     }
                 }
-                for( i=i+1; i<wdata.size(); i++ )
+                if( list2.empty() )
                 {
-                    if( words[i].flags & WF_Must )
-                    {
-                        auto& vtest = wdata[i];
-                        auto begin = vtest.second;
-                        auto end = begin + vtest.first;
-                        auto it = include.begin();
-                        while( it != include.end() )
-                        {
-                            auto vit = std::lower_bound( begin, end, *it, [] ( const auto& l, const auto& r ) { return l.postid < r; } );
-                            if( vit == end || vit->postid != *it )
-                            {
-                                it = include.erase( it );
-                            }
-                            else
-                            {
-                                ++it;
-                            }
-                        }
-                    }
+                    drank += 127;
                 }
-            }
-            else
-            {
-                for( int i=0; i<wdata.size(); i++ )
-                {
-                    if( !( words[i].flags & WF_Cant ) )
-                    {
-                        assert( !( words[i].flags & WF_Must ) );
-                        for( int j=0; j<wdata[i].first; j++ )
-                        {
-                            auto& v = wdata[i].second[j];
-                            include.emplace( v.postid );
-                        }
-                    }
-                }
-            }
-            if( include.empty() ) return result;
-
-            if( hasCant )
-            {
-                for( int i=0; i<wdata.size(); i++ )
+                else
                 {
-                    if( words[i].flags & WF_Cant )
-                    {
-                        for( int j=0; j<wdata[i].first; j++ )
-                        {
-                            auto& v = wdata[i].second[j];
-                            auto it = include.find( v.postid );
-                            if( it != include.end() )
-                            {
-                                include.erase( it );
-                            }
-                        }
-                    }
+                    drank += GetWordDistance( list1.data(), list1.size(), list2.data(), list2.size() );
+                    std::swap( list1, list2 );
                 }
-                if( include.empty() ) return result;
             }
         }
+        assert( drank != 0 );
+        rank /= drank;
     }
-
-    struct Posts
+    if( !( flags & SF_SimpleSearch ) )
     {
-        uint32_t word;
-        const PostData* data;
-    };
+        rank *= PostRank( posts[0].data );
+    }
 
-    int count = 0;
-    for( uint32_t word = 0; word < wsize; word++ )
+    if( !KeepRank( scratch.top, keep, rank ) )
     {
-        count += wdata[word].first;
+        // Won't make it to the returned results, hit data is not needed.
+        sr = PrepareResults( postid, rank, 0 );
+        return false;
     }
 
-    auto index = new int32_t[m_archive.NumberOfMessages()];
-    memset( index, 0xFF, sizeof( int32_t ) * m_archive.NumberOfMessages() );
-
-    auto pnum = new uint32_t[count];
-    auto postid = new uint32_t[count];
-    auto pdata = new Posts[count*wsize];
+    for( int m=0; m<num; m++ )
+    {
+        auto& v = posts[m];
+        for( int i=0; i<v.data.hitnum; i++ )
+        {
+            wordlist.emplace_back( v.word );
+            hits.emplace_back( v.data.hits[i] );
+        }
+    }
+    idx.reserve( hits.size() );
+    for( int i=0; i<hits.size(); i++ )
+    {
+        idx.emplace_back( i );
+    }
 
-    int next = 0;
-    for( uint32_t word = 0; word < wsize; word++ )
+    int idxsize = idx.size();
+    if( idxsize > 1 )
     {
-        for( int i=0; i<wdata[word].first; i++ )
+        std::sort( idx.begin(), idx.end(), [&hits]( const auto& l, const auto& r ) { return LexiconHitRank( hits[l] ) > LexiconHitRank( hits[r] ); } );
+
+        bool hitmask[256];
+        memset( &hitmask, 0, sizeof( hitmask ) );
+        int i=0;
+        while( i<idxsize )
         {
-            auto& post = wdata[word].second[i];
-            auto pidx = post.postid;
-            if( !checkInclude || include.find( pidx ) != include.end() )
+            const auto hit = hits[idx[i]];
+            if( !LexiconHitIsMaxPos( hit ) )
             {
-                int idx;
-                if( index[pidx] == -1 )
+                if( !hitmask[hit] )
                 {
-                    index[pidx] = next;
-                    idx = next++;
-                    pnum[idx] = 0;
-                    postid[idx] = pidx;
+                    hitmask[hit] = true;
+                    i++;
                 }
                 else
                 {
-                    idx = index[pidx];
+                    idx.erase( idx.begin() + i );
+                    idxsize--;
                 }
-                pdata[idx*wsize + pnum[idx]] = Posts { word, &post };
-                pnum[idx]++;
+            }
+            else
+            {
+                i++;
             }
         }
     }
 
-    delete[] index;
-
-    std::vector<const PostData*> list1, list2;
-    list1.reserve( wsize );
-    list2.reserve( wsize );
-    std::vector<uint8_t> hits;
-    std::vector<uint32_t> wordlist;
-    std::vector<uint32_t> idx;
-    result.reserve( next );
-    for( int k=0; k<next; k++ )
+    sr = PrepareResults( postid, rank, idxsize );
+    const auto n = sr.hitnum;
+    for( int i=0; i<n; i++ )
     {
-        hits.clear();
-        wordlist.clear();
-        idx.clear();
+        sr.hits[i] = hits[idx[i]];
+        sr.words[i] = wordlist[idx[i]];
+    }
+    return true;
+}
 
-        float rank = 0;
-        for( int m=0; m<pnum[k]; m++ )
+void SearchEngine::GetFullResult( SearchContext& ctx, int flags, uint32_t groups, uint32_t missing, size_t keep ) const
+{
+    const auto& words = ctx.m_words;
+    auto& cursors = ctx.m_cursors;
+    auto& result = ctx.m_data.results;
+    const auto wsize = std::min<size_t>( 1024, words.size() );
+
+    // Posts in all of the must lists (or in any list, if there are no must
+    // words), and in none of the cant lists, are candidates. Only postings
+    // of the first wsize words are ranked.
+    auto& must = ctx.m_must;
+    auto& cant = ctx.m_cant;
+    auto& order = ctx.m_order;
+    must.clear();
+    cant.clear();
+    order.clear();
+    for( uint32_t i=0; i<words.size(); i++ )
+    {
+        const auto wf = ( flags & SF_SetLogic ) ? words[i].flags : WF_None;
+        if( wf & WF_Must )
         {
-            auto& v = pdata[k*wsize + m];
-            if( flags & SF_SimpleSearch )
-            {
-                rank += HitRankSimple( *v.data ) * words[v.word].mod;
-            }
-            else
+            must.emplace_back( &cursors[i] );
+        }
+        else if( wf & WF_Cant )
+        {
+            cant.emplace_back( &cursors[i] );
+        }
+        else if( !( wf & WF_Negated ) && i < wsize && cursors[i].postid != PostCursorEnd )
+        {
+            order.emplace_back( &cursors[i] );
+        }
+    }
+    ctx.m_match.resize( words.size() );
+
+    // Candidates are gathered in batches, each with its postings in word
+    // order at [first[k], first[k+1]) of pdata. Postings are copied out of
+    // the cursors, which move on.
+    auto& first = ctx.m_pfirst;
+    auto& postid = ctx.m_postid;
+    auto& pdata = ctx.m_pdata;
+    first.assign( 1, 0 );
+    postid.clear();
+    pdata.clear();
+
+    // Ranking threads, including the calling one. Each has its own scratch.
+    const auto workers = m_td ? m_td->NumberOfWorkers() : 1;
+    if( ctx.m_scratch.size() < workers ) ctx.m_scratch.resize( workers );
+    for( auto& v : ctx.m_scratch ) v.top.clear();
+
+    // Each candidate is ranked independently, and stored at its own slot.
+    // Every ranking thread tracks its own best ranks. Anything that doesn't
+    // make it to the local top can't make it to the global one either.
+    const auto Flush = [&] {
+        const auto next = int( postid.size() );
+        const auto base = result.size();
+        result.resize( base + next );
+        auto Rank = [&] ( int k, SearchContext::Scratch& scratch ) {
+            RankPost( ctx, scratch, postid[k], pdata.data() + first[k], first[k+1] - first[k], flags, groups, missing, keep, result[base+k] );
+        };
+        if( workers < 2 || next < ParallelMinCandidates )
+        {
+            auto& scratch = ctx.m_scratch[0];
+            for( int k=0; k<next; k++ ) Rank( k, scratch );
+        }
+        else
+        {
+            // Each worker has its own scratch space in the context.
+            std::atomic<int> cnt( 0 );
+            for( size_t i=0; i<workers; i++ )
             {
-                rank += HitRank( *v.data ) * words[v.word].mod;
+                m_td->Queue( [&cnt, &Rank, &scratch = ctx.m_scratch[i], next] {
+                    for(;;)
+                    {
+                        const auto start = cnt.fetch_add( ParallelBatch, std::memory_order_relaxed );
+                        if( start >= next ) return;
+                        const auto end = std::min( start + ParallelBatch, next );
+                        for( int k=start; k<end; k++ ) Rank( k, scratch );
+                    }
+                } );
             }
-            for( int i=0; i<v.data->hitnum; i++ )
+            m_td->Sync();
+        }
+        Collect( ctx, flags, keep );
+        first.resize( 1 );
+        postid.clear();
+        pdata.clear();
+    };
+
+    size_t total = 0;
+    if( !must.empty() )
+    {
+        Intersect( must, cant, ctx.m_match.data(), [&] ( uint32_t id, const PostData** match ) {
+            if( !ctx.m_phrases.empty() && !MatchPhrases( ctx, id, match ) ) return;
+            if( !ctx.m_negated.empty() && HasNegated( ctx, id ) ) return;
+            for( uint32_t i=0; i<wsize; i++ )
             {
-                wordlist.emplace_back( v.word );
-                hits.emplace_back( v.data->hits[i] );
+                const auto wf = words[i].flags;
+                if( wf & WF_Must )
+                {
+                    pdata.emplace_back( SearchContext::Posts { i, *match[i] } );
+                }
+                else if( !( wf & ( WF_Cant | WF_Negated ) ) )
+                {
+                    auto& c = cursors[i];
+                    Seek( c, id );
+                    if( c.postid == id ) pdata.emplace_back( SearchContext::Posts { i, c.post[c.pos] } );
+                }
             }
-        }
-        if( flags & SF_AdjacentWords && groups > 1 )
+            postid.emplace_back( id );
+            first.emplace_back( uint32_t( pdata.size() ) );
+            total++;
+            if( postid.size() >= RankBatch || pdata.size() >= RankBatch ) Flush();
+        } );
+    }
+    else
+    {
+        // Lists are read in windows of postids, each list up to a few blocks
+        // ahead, so that a window fits in a batch. Postings of a window are
+        // grouped by post with a counting sort, which keeps them in word
+        // order. Posts in the cant lists, or holding a negated phrase, are
+        // marked in the index first.
+        auto& index = ctx.m_index;
+        auto& count = ctx.m_pnum;
+        auto& wslot = ctx.m_wslot;
+        auto& wpost = ctx.m_wpost;
+        index.Reset( m_archive.NumberOfMessages() );
+        while( !order.empty() )
         {
-            int drank = 127 * missing;
-            list1.clear();
-            int g;
-            for( g = 0; g < groups-1; g++ )
+            const auto ahead = uint32_t( RankBatch / ( LexiconBlockSize * order.size() ) );
+            uint32_t last = PostCursorEnd;
+            for( auto c : order ) last = std::min( last, BlockLast( *c, std::min( c->block + ahead, c->numBlocks - 1 ) ) );
+
+            for( auto c : cant )
             {
-                for( int m=0; m<pnum[k]; m++ )
+                while( c->postid <= last )
                 {
-                    auto& v = pdata[k*wsize + m];
-                    if( words[v.word].group == g )
-                    {
-                        list1.emplace_back( v.data );
-                    }
+                    index.Set( c->postid, -1 );
+                    Next( *c );
                 }
-                if( !list1.empty() )
+            }
+            for( auto& phrase : ctx.m_negated )
+            {
+                const auto slots = ctx.m_phraseSlots.data() + phrase.first;
+                auto& lead = cursors[*std::find_if( slots, slots + phrase.size, [] ( uint32_t v ) { return v != PhraseGap; } )];
+                while( lead.postid <= last )
                 {
-                    g++;
-                    break;
+                    if( HasPhrase( ctx, phrase, lead.postid ) ) index.Set( lead.postid, -1 );
+                    Next( lead );
                 }
-                drank += 127;
             }
-            if( !list1.empty() )
+
+            const auto base = uint32_t( postid.size() );
+            count.clear();
+            wslot.clear();
+            wpost.clear();
+            for( auto c : order )
             {
-                for( ; g<groups; g++ )
+                while( c->postid <= last )
                 {
-                    list2.clear();
-                    for( int m=0; m<pnum[k]; m++ )
+                    const auto id = c->postid;
+                    if( !index.Has( id ) )
                     {
-                        auto& v = pdata[k*wsize + m];
-                        if( words[v.word].group == g )
-                        {
-                            list2.emplace_back( v.data );
-                        }
+                        index.Set( id, int32_t( postid.size() ) );
+                        postid.emplace_back( id );
+                        count.emplace_back( 0 );
                     }
-                    if( list2.empty() )
+                    const auto slot = index[id];
+                    if( slot >= 0 )
                     {
-                        drank += 127;
-                    }
-                    else
-                    {
-                        drank += GetWordDistance( list1, list2 );
-                        std::swap( list1, list2 );
+                        count[slot - base]++;
+                        wslot.emplace_back( slot - base );
+                        wpost.emplace_back( SearchContext::Posts { c->word, c->post[c->pos] } );
                     }
+                    Next( *c );
                 }
             }
-            assert( drank != 0 );
-            rank /= drank;
-        }
-        idx.reserve( hits.size() );
-        for( int i=0; i<hits.size(); i++ )
-        {
-            idx.emplace_back( i );
+            order.erase( std::remove_if( order.begin(), order.end(), [] ( const PostCursor* c ) { return c->postid == PostCursorEnd; } ), order.end() );
+
+            auto offset = uint32_t( pdata.size() );
+            for( auto& v : count )
+            {
+                const auto n = v;
+                v = offset;
+                offset += n;
+                first.emplace_back( offset );
+            }
+            pdata.resize( offset );
+            for( size_t i=0; i<wpost.size(); i++ ) pdata[count[wslot[i]]++] = wpost[i];
+            total += postid.size() - base;
+            if( postid.size() >= RankBatch || pdata.size() >= RankBatch ) Flush();
         }
+    }
+    Flush();
+    ctx.m_data.total = total;
+}
 
-        int idxsize = idx.size();
-        if( idxsize > 1 )
-        {
-            std::sort( idx.begin(), idx.end(), [&hits]( const auto& l, const auto& r ) { return LexiconHitRank( hits[l] ) > LexiconHitRank( hits[r] ); } );
+// Only the best results of a ranked query are wanted, and posting lists
+// carry per-block rank bounds.
+bool SearchEngine::CanSkipBlocks( const SearchContext& ctx, int flags, size_t keep ) const
+{
+    if( keep == 0 || keep == NoLimit ) return false;
+    if( flags & ( SF_RequireAllWords | SF_SimpleSearch ) ) return false;
+    if( ctx.m_words.size() < 2 || !m_archive.m_hasLexpost ) return false;
+    for( auto& w : ctx.m_words )
+    {
+        if( w.flags & ( WF_Must | WF_Cant | WF_Negated ) ) return false;
+    }
+    return true;
+}
+
+// Block-max WAND. Cursors are kept ordered by current postid. The pivot is
+// the first post at which the sum of list bounds can reach the lowest of the
+// keep best ranks; posts before it can't get to the results. If bounds of the
+// blocks holding the pivot also can reach it, the pivot is ranked, otherwise
+// the lists skip past these blocks. Ranks are computed exactly as in
+// GetFullResult, so the kept results are the same.
+void SearchEngine::GetBlockMaxResult( SearchContext& ctx, int flags, int filter, uint32_t groups, uint32_t missing, size_t keep ) const
+{
+    const auto& words = ctx.m_words;
+    auto& result = ctx.m_data.results;
+    const auto wsize = std::min<size_t>( 1024, words.size() );
+
+    auto& cursors = ctx.m_cursors;
+    auto& order = ctx.m_order;
+    if( cursors.size() < wsize ) cursors.resize( wsize );
+    order.clear();
+
+    // Skipped blocks are never decoded, so posts can't be counted. The total
+    // is estimated from the number of postings in the searched blocks of each
+    // list, as if words were spread over posts independently of each other.
+    const auto& where = ctx.m_where;
+    const size_t posts = where.active ? where.postMax - where.postMin + 1 : m_archive.NumberOfMessages();
+    size_t sum = 0;
+    size_t largest = 0;
+    double none = 1;
+    for( uint32_t w=0; w<wsize; w++ )
+    {
+        auto& c = cursors[order.size()];
+        OpenCursor( ctx, c, w, filter );
+        if( c.postid == PostCursorEnd ) continue;
+        float max = 0;
+        for( uint32_t b=c.block; b<c.numBlocks; b++ ) max = std::max( max, c.blocks[b].max );
+        c.max = max * c.mod * BoundSlack;
+        const size_t cnt = std::min<size_t>( posts, std::min( c.size, c.numBlocks * LexiconBlockSize ) - c.block * LexiconBlockSize );
+        sum += cnt;
+        largest = std::max( largest, cnt );
+        none *= 1 - double( cnt ) / posts;
+        order.emplace_back( &c );
+    }
+    const auto estimate = size_t( posts * ( 1 - none ) + 0.5 );
+    ctx.m_data.total = std::max( largest, std::min( { estimate, sum, posts } ) );
+    ctx.m_data.estimated = true;
+    ctx.Mark( &SearchProfile::posts );
+
+    if( ctx.m_scratch.empty() ) ctx.m_scratch.resize( 1 );
+    auto& scratch = ctx.m_scratch[0];
+    auto& top = scratch.top;
+    top.clear();
+    auto& pivotPosts = ctx.m_pivot;
+
+    // Posts lacking some of the words are ranked down by the word distance
+    // rank, see RankPost. Its lowest value tightens the bounds of such posts.
+    auto& groupset = ctx.m_groupset;
+    const bool adjacent = flags & SF_AdjacentWords && groups > 1;
+    const auto MinDistanceRank = [adjacent, groups, missing] ( uint32_t covered ) {
+        if( !adjacent ) return 1.f;
+        return float( std::max<uint32_t>( 1, 127 * ( missing + groups - covered ) + covered - 1 ) );
+    };
 
-            bool hitmask[256];
-            memset( &hitmask, 0, sizeof( hitmask ) );
-            int i=0;
-            while( i<idxsize )
+    const auto size = order.size();
+    const auto cmp = [] ( const PostCursor* l, const PostCursor* r ) { return l->postid < r->postid; };
+    std::sort( order.begin(), order.end(), cmp );
+    for(;;)
+    {
+        const auto threshold = top.size() < keep ? -1.f : top.front();
+
+        groupset.Reset( groups );
+        uint32_t covered = 0;
+        const auto Cover = [&] ( const PostCursor& c ) {
+            const auto g = words[c.word].group;
+            if( !groupset.Has( g ) )
             {
-                const auto hit = hits[idx[i]];
-                if( !LexiconHitIsMaxPos( hit ) )
-                {
-                    if( !hitmask[hit] )
-                    {
-                        hitmask[hit] = true;
-                        i++;
-                    }
-                    else
-                    {
-                        idx.erase( idx.begin() + i );
-                        idxsize--;
-                    }
-                }
-                else
-                {
-                    i++;
-                }
+                groupset.Set( g, 1 );
+                covered++;
             }
+        };
+
+        size_t p = 0;
+        float acc = 0;
+        for( ; p<size; p++ )
+        {
+            if( order[p]->postid == PostCursorEnd ) break;
+            acc += order[p]->max;
+            Cover( *order[p] );
+            if( acc / MinDistanceRank( covered ) >= threshold ) break;
         }
+        if( p == size || order[p]->postid == PostCursorEnd ) break;
+        const auto pivot = order[p]->postid;
+        while( p+1 < size && order[p+1]->postid == pivot ) Cover( *order[++p] );
 
-        if( flags & SF_SimpleSearch )
+        float bound = 0;
+        uint32_t next = p+1 < size ? order[p+1]->postid : PostCursorEnd;
+        for( size_t i=0; i<=p; i++ )
+        {
+            auto& c = *order[i];
+            const auto b = ShallowSeek( c, pivot );
+            if( b == c.numBlocks ) continue;
+            bound += c.blocks[b].max * c.mod * BoundSlack;
+            next = std::min( next, c.blocks[b].last + 1 );
+        }
+
+        bound /= MinDistanceRank( covered );
+
+        size_t advanced;
+        if( bound < threshold )
         {
-            result.emplace_back( PrepareResults( postid[k], rank, idxsize ) );
+            // No post up to the end of the shortest of the pivot's blocks can make it.
+            next = std::max( next, pivot + 1 );
+            for( advanced=0; advanced<=p; advanced++ ) Seek( *order[advanced], next );
+        }
+        else if( order[0]->postid == pivot )
+        {
+            pivotPosts.clear();
+            for( size_t i=0; i<=p; i++ )
+            {
+                pivotPosts.emplace_back( SearchContext::Posts { order[i]->word, order[i]->post[order[i]->pos] } );
+            }
+            std::sort( pivotPosts.begin(), pivotPosts.end(), [] ( const auto& l, const auto& r ) { return l.word < r.word; } );
+            SearchResult sr;
+            if( RankPost( ctx, scratch, pivot, pivotPosts.data(), pivotPosts.size(), flags, groups, missing, keep, sr ) )
+            {
+                result.emplace_back( sr );
+            }
+            for( advanced=0; advanced<=p; advanced++ ) Seek( *order[advanced], pivot + 1 );
         }
         else
         {
-            result.emplace_back( PrepareResults( postid[k], rank * PostRank( *pdata[k*wsize].data ), idxsize ) );
+            for( advanced=0; order[advanced]->postid < pivot; advanced++ ) Seek( *order[advanced], pivot );
         }
-        auto& sr = result.back();
-        const auto n = sr.hitnum;
-        for( int i=0; i<n; i++ )
+
+        // Cursors past the advanced ones are still in order, insert the moved ones back.
+        for( size_t i=advanced; i-->0; )
         {
-            sr.hits[i] = hits[idx[i]];
-            sr.words[i] = wordlist[idx[i]];
+            auto c = order[i];
+            size_t j = i;
+            while( j+1 < size && order[j+1]->postid < c->postid )
+            {
+                order[j] = order[j+1];
+                j++;
+            }
+            order[j] = c;
         }
     }
-
-    delete[] pnum;
-    delete[] postid;
-    delete[] pdata;
-
-    return result;
 }
 
-SearchData SearchEngine::Search( const std::vector<std::string>& terms, int flags, int filter ) const
+const SearchData& SearchEngine::Search( SearchContext& ctx, const std::vector<std::string>& query, int flags, int filter, size_t limit, size_t offset, const SearchFilter& where ) const
 {
-    SearchData ret;
+    // Lexicon words are lower case. Terms are folded before anything looks
+    // at them, so that all spellings of a query find the same words and share
+    // a cache entry.
+    auto& terms = ctx.m_folded;
+    terms.resize( query.size() );
+    for( size_t i=0; i<query.size(); i++ )
+    {
+        terms[i].assign( query[i] );
+        for( auto& c : terms[i] ) if( c >= 'A' && c <= 'Z' ) c += 'a' - 'A';
+    }
+
+    auto& ret = ctx.m_data;
+    auto& result = ret.results;
+    result.clear();
+    ret.threads.clear();
+    ret.total = 0;
+    ret.estimated = false;
+
+    const size_t keep = limit > SIZE_MAX - offset ? SIZE_MAX : offset + limit;
 
     flags = FixupFlags( flags );
+    ctx.StartProfile();
 
-    std::vector<WordData> words;
-    std::vector<const char*> matched;
+    const auto& cache = m_archive.m_searchCache;
+    if( cache )
+    {
+        SearchCache::MakeKey( ctx.m_key, m_archive.m_id, terms, flags, filter, where );
+        if( cache->Get( ctx.m_key, keep, offset, ret ) )
+        {
+            ctx.m_profile.cached = ctx.m_profiling;
+            return ret;
+        }
+    }
 
-    auto groups = ExtractWords( terms, flags, words, matched );
+    auto groups = ExtractWords( ctx, terms, flags );
     assert( groups <= terms.size() );
-    if( groups == 0 ) return ret;
-    if( words.size() == 1 && words[0].flags & WF_Cant ) return ret;
+    if( groups == 0 || ( ctx.m_words.size() == 1 && ctx.m_words[0].flags & WF_Cant ) )
+    {
+        ret.matched.clear();
+        return ret;
+    }
+    if( filter != T_All )
+    {
+        for( auto& v : ctx.m_phrases ) v.type = filter;
+        for( auto& v : ctx.m_negated ) v.type = filter;
+    }
+    Restrict( ctx, where );
+    ctx.Mark( &SearchProfile::words );
+
+    // Any message may raise the rank of its thread, so grouped searches rank
+    // every matching post. Threads are accumulated along the way, in slots
+    // indexed by thread root.
+    const bool grouped = flags & SF_GroupThreads;
+    const auto rankKeep = grouped ? size_t( NoLimit ) : keep;
+    if( grouped )
+    {
+        ctx.m_threads.clear();
+        ctx.m_threadSlot.Reset( m_archive.NumberOfMessages() );
+    }
 
-    const auto wdata = GetPostsForWords( words, filter );
-    assert( wdata.size() == words.size() );
+    if( CanSkipBlocks( ctx, flags, rankKeep ) )
+    {
+        GetBlockMaxResult( ctx, flags, filter, groups, terms.size() - groups, rankKeep );
+    }
+    else
+    {
+        OpenCursors( ctx, filter );
+        ctx.Mark( &SearchProfile::posts );
 
-    std::vector<SearchResult> result;
+        if( ctx.m_words.size() == 1 && ctx.m_phrases.empty() )
+        {
+            GetSingleResult( ctx, flags, rankKeep );
+        }
+        else if( flags & SF_RequireAllWords )
+        {
+            assert( !( flags & SF_SetLogic ) );
+            assert( !( flags & SF_FuzzySearch ) );
+            GetAllWordResult( ctx, flags, groups, terms.size() - groups, rankKeep );
+        }
+        else
+        {
+            GetFullResult( ctx, flags, groups, terms.size() - groups, rankKeep );
+        }
+    }
+    if( grouped )
+    {
+        FoldThreads( ctx );
+        ret.total = ctx.m_threads.size();
+    }
+    ctx.Mark( &SearchProfile::rank );
 
-    if( wdata.size() == 1 )
+    // Terms unknown to the lexicon cost as much as words missing from a post,
+    // but a single word group gets no distance ranking to charge them. Charge
+    // them here, so that ranks don't depend on which words an archive has and
+    // can be compared between archives.
+    if( flags & SF_AdjacentWords && groups == 1 && terms.size() > 1 )
     {
-        result = GetSingleResult( wdata, flags );
+        const auto scale = 1.f / ( 127 * ( terms.size() - 1 ) );
+        for( auto& v : result ) v.rank *= scale;
+        for( auto& v : ctx.m_threads )
+        {
+            v.best.rank *= scale;
+            v.sum *= scale;
+        }
     }
-    else if( flags & SF_RequireAllWords )
+
+    if( grouped )
     {
-        assert( !( flags & SF_SetLogic ) );
-        assert( !( flags & SF_FuzzySearch ) );
-        result = GetAllWordResult( wdata, flags, groups, terms.size() - groups );
+        auto& threads = ctx.m_threads;
+        const auto ThreadOrder = [] ( const SearchContext::ThreadRank& l, const SearchContext::ThreadRank& r ) { return ResultOrder( l.best, r.best ); };
+        if( keep < threads.size() )
+        {
+            std::partial_sort( threads.begin(), threads.begin() + keep, threads.end(), ThreadOrder );
+            threads.resize( keep );
+        }
+        else
+        {
+            std::sort( threads.begin(), threads.end(), ThreadOrder );
+        }
+        const auto& conn = *m_archive.m_connectivity;
+        result.reserve( threads.size() );
+        ret.threads.reserve( threads.size() );
+        for( auto& v : threads )
+        {
+            result.emplace_back( v.best );
+            ret.threads.emplace_back( SearchThread { conn.Root( v.best.postid ), v.count, v.sum } );
+        }
+    }
+    else if( keep < result.size() )
+    {
+        std::partial_sort( result.begin(), result.begin() + keep, result.end(), ResultOrder );
+        result.resize( keep );
     }
     else
     {
-        result = GetFullResult( wdata, words, flags, groups, terms.size() - groups );
+        std::sort( result.begin(), result.end(), ResultOrder );
     }
 
-    slab.Reset();
-
-    if( result.empty() ) return ret;
-
-    std::sort( result.begin(), result.end(), []( const auto& l, const auto& r ) { return l.rank > r.rank; } );
-
-    std::swap( ret.matched, matched );
-    std::swap( ret.results, result );
+    if( result.empty() )
+    {
+        ret.matched.clear();
+        if( cache ) cache->Insert( ctx.m_key, keep, ret );
+        return ret;
+    }
+    ctx.Mark( &SearchProfile::sort );
+    if( cache ) cache->Insert( ctx.m_key, keep, ret );
+    result.erase( result.begin(), result.begin() + std::min( offset, result.size() ) );
+    ret.threads.erase( ret.threads.begin(), ret.threads.begin() + std::min( offset, ret.threads.size() ) );
 
     return ret;
 }
@@ -1,12 +1,19 @@
 #ifndef __SEARCHENGINE_HPP__
 #define __SEARCHENGINE_HPP__
 
+#include <chrono>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
+#include "../common/ExpandingBuffer.hpp"
+#include "../common/LexiconPosting.hpp"
 #include "../common/LexiconTypes.hpp"
+#include "../common/StampedArray.hpp"
 
 class Archive;
+class ConnectivityView;
+class TaskDispatch;
 
 enum { SearchResultMaxHits = 4 };
 
@@ -19,23 +26,239 @@ struct SearchResult
     uint32_t words[SearchResultMaxHits];
 };
 
+// Thread of grouped search results. Its best message is the result at the
+// same position, the thread's rank is the rank of that message.
+struct SearchThread
+{
+    uint32_t root;          // top level message of the thread
+    uint32_t count;         // matching messages in the thread
+    float sum;              // sum of their ranks
+};
+
 struct SearchData
 {
     std::vector<SearchResult> results;
+    std::vector<SearchThread> threads;  // with SF_GroupThreads, one for each result
     std::vector<const char*> matched;
+    size_t total = 0;       // number of matching posts (threads, if grouped), results may hold only a part of them
+    bool estimated = false; // total is estimated, not counted, see SearchEngine::Search
+};
+
+// Time spent in phases of a search, in nanoseconds.
+struct SearchProfile
+{
+    uint64_t words = 0;     // query parsing, word lookup, filter setup
+    uint64_t posts = 0;     // opening of posting lists
+    uint64_t rank = 0;      // posting list traversal and ranking
+    uint64_t sort = 0;      // final ordering of results
+    bool cached = false;    // results came from the search cache
+};
+
+// Restricts a search to posts meeting all of the set conditions. Posts are
+// checked while posting lists are read, so the ones which fail never reach
+// ranking.
+struct SearchFilter
+{
+    uint32_t dateFrom = 0;      // posts dated in [dateFrom, dateTo), if any of them is set; zero dateTo is no upper limit
+    uint32_t dateTo = 0;
+    int32_t thread = -1;        // the post and all of its replies, if set
+    bool toplevel = false;      // only posts starting a thread
+    std::string author;         // case-insensitive part of the From header, if set
+
+    bool HasDate() const { return dateFrom != 0 || dateTo != 0; }
+    bool Empty() const { return !HasDate() && thread < 0 && !toplevel && author.empty(); }
+};
+
+// Search filter resolved for the searched archive. Posts outside of
+// [postMin, postMax] can't pass it, parts of posting lists outside the
+// range are skipped.
+struct PostRestriction
+{
+    bool active = false;
+    const SearchFilter* filter;
+    const Archive* archive;
+    const ConnectivityView* conn;
+    uint32_t postMin;
+    uint32_t postMax;
+    StampedArray<uint8_t> thread;
+
+    bool Accepts( uint32_t postid ) const;
 };
 
 struct WordData
 {
     uint32_t word;
     float mod;
-    uint32_t flags : 4;     // WordFlags
-    uint32_t group : 27;
+    uint32_t flags : 5;     // WordFlags
+    uint32_t group : 26;
     uint32_t strict : 1;
 };
 static_assert( sizeof( WordData ) == 12, "Wrong word data struct size" );
 
-struct PostData;
+struct PostData
+{
+    uint32_t postid;
+    uint8_t hitnum;
+    uint8_t children;
+    const uint8_t* hits;
+};
+
+enum : uint32_t { PostCursorEnd = 0xFFFFFFFF };
+
+// Position in a posting list, which is read one block at a time. Postings of
+// the current block which pass the search filters are decoded into post, so
+// a cursor takes the same memory whatever the size of its list. Compressed
+// lists are read in their own blocks, lexdata lists in runs of
+// LexiconBlockSize postings.
+struct PostCursor
+{
+    const LexiconBlockInfo* blocks;     // compressed list, or null
+    const LexiconDataPacket* data;      // lexdata list, if not compressed
+    const uint8_t* lexhit;
+    const PostRestriction* where;
+    int filter;
+    uint32_t numBlocks;
+    uint32_t size;      // postings in the list, or in data
+    uint32_t word;      // index of the list in the word list
+    uint32_t wf;
+    float mod;
+    float max;          // upper bound of the list's contribution to rank
+    uint32_t block;
+    uint32_t pos;
+    uint32_t num;
+    uint32_t postid;    // current postid, PostCursorEnd if the list is exhausted
+    PostData post[LexiconBlockSize];
+};
+
+// Scratch memory of a search: posting list cursors, candidate batches,
+// ranking buffers and the result itself. Buffers are kept between queries
+// and only grow, so once a context has seen a query of given size, further
+// queries of that size don't allocate. A context may be used with any number of search engines,
+// but only by one search at a time.
+class SearchContext
+{
+public:
+    SearchContext() = default;
+    SearchContext( const SearchContext& ) = delete;
+    SearchContext& operator=( const SearchContext& ) = delete;
+
+    // With profiling enabled, each search records its phase timings.
+    void EnableProfile( bool enable ) { m_profiling = enable; }
+    const SearchProfile& GetProfile() const { return m_profile; }
+
+private:
+    friend class SearchEngine;
+
+    void StartProfile()
+    {
+        if( !m_profiling ) return;
+        m_profile = SearchProfile();
+        m_mark = std::chrono::steady_clock::now();
+    }
+
+    // Adds time since the previous mark to the phase.
+    void Mark( uint64_t SearchProfile::* phase )
+    {
+        if( !m_profiling ) return;
+        const auto now = std::chrono::steady_clock::now();
+        m_profile.*phase += std::chrono::duration_cast<std::chrono::nanoseconds>( now - m_mark ).count();
+        m_mark = now;
+    }
+
+    struct Posts
+    {
+        uint32_t word;
+        PostData data;
+    };
+
+    struct Scratch
+    {
+        std::vector<const PostData*> list1, list2;
+        std::vector<uint8_t> hits;
+        std::vector<uint32_t> wordlist;
+        std::vector<uint32_t> idx;
+        std::vector<float> top;
+    };
+
+    // Quoted words which have to appear next to each other, or must not, if
+    // the phrase is negated. Slots and texts of the words are at
+    // [first, first+size) of m_phraseSlots and m_phraseText.
+    struct Phrase
+    {
+        uint32_t first;
+        uint32_t size;
+        int type;       // T_From, T_Subject or T_All
+    };
+
+    // Term to be extended with similar words by fuzzy search. Its text is
+    // [begin, end) of the term string, its own words are [first, last) of
+    // m_words. Terms not in the lexicon have no words, but get a group at
+    // their position in the query, which is dropped if nothing similar is found.
+    struct FuzzyTerm
+    {
+        uint32_t term;
+        uint32_t begin, end;
+        uint32_t first, last;
+        uint32_t group;
+        uint32_t wf;
+        int dist;           // max edit distance, -1 for default
+        bool wildcard;
+    };
+
+    std::vector<std::string> m_terms;
+    std::vector<std::string> m_folded;
+    std::string m_key;
+    std::string m_word;
+    std::vector<uint32_t> m_processed;
+    StampedArray<uint8_t> m_wordset;
+    std::vector<WordData> m_words;
+
+    std::vector<Phrase> m_phrases;
+    std::vector<Phrase> m_negated;
+    std::vector<uint32_t> m_phraseSlots;
+    std::vector<std::string> m_phraseText;
+    std::vector<FuzzyTerm> m_fuzzy;
+    std::vector<std::pair<uint32_t, uint32_t>> m_similar;
+    std::vector<std::pair<const char*, uint32_t>> m_tokens[NUM_LEXICON_TYPES];
+    ExpandingBuffer m_eb;
+
+    std::vector<PostCursor> m_cursors;
+    std::vector<PostCursor*> m_order;
+    std::vector<PostCursor*> m_must;
+    std::vector<PostCursor*> m_cant;
+    std::vector<const PostData*> m_match;
+
+    StampedArray<int32_t> m_index;
+    std::vector<uint32_t> m_pfirst;
+    std::vector<uint32_t> m_pnum;
+    std::vector<uint32_t> m_postid;
+    std::vector<Posts> m_pdata;
+    std::vector<uint32_t> m_wslot;
+    std::vector<Posts> m_wpost;
+    std::vector<Scratch> m_scratch;
+
+    std::vector<Posts> m_pivot;
+    StampedArray<uint8_t> m_groupset;
+
+    // Threads seen by a grouped search, and their slots by root.
+    struct ThreadRank
+    {
+        SearchResult best;
+        float sum;
+        uint32_t count;
+    };
+    std::vector<ThreadRank> m_threads;
+    StampedArray<uint32_t> m_threadSlot;
+
+    PostRestriction m_where;
+    std::vector<uint32_t> m_stack;
+
+    SearchData m_data;
+
+    bool m_profiling = false;
+    SearchProfile m_profile;
+    std::chrono::steady_clock::time_point m_mark;
+};
 
 class SearchEngine
 {
@@ -45,28 +268,58 @@ public:
         SF_FlagsNone        = 0,
         SF_AdjacentWords    = 1 << 0,   // Calculate words adjacency
         SF_RequireAllWords  = 1 << 1,   // Require all words to be present
-        SF_FuzzySearch      = 1 << 2,   // Also search for similar words
+        SF_FuzzySearch      = 1 << 2,   // Also search for similar words, with set logic word~N allows at most N edits
         SF_SetLogic         = 1 << 3,   // Parse set logic functions (search in headers, search for exact words, etc.)
         SF_SimpleSearch     = 1 << 4,   // Disable "advanced" ranking features (number of children, total number number of hits)
+        SF_GroupThreads     = 1 << 5,   // Return one result per thread, its best ranked message
     };
 
-    SearchEngine( const Archive& archive );
+    // With a task dispatcher, ranking of large candidate sets is split between
+    // its workers. Dispatcher must not be used by anyone else during a search.
+    SearchEngine( const Archive& archive, TaskDispatch* td = nullptr );
 
-    SearchData Search( const char* query, int flags = SF_FlagsNone, int filter = T_All ) const;
-    SearchData Search( const std::vector<std::string>& terms, int flags = SF_FlagsNone, int filter = T_All ) const;
+    enum : size_t { NoLimit = SIZE_MAX };
 
-private:
-    using PostDataVec = std::pair<uint32_t, PostData*>;
+    // Results are ordered by rank. Only results in [offset, offset+limit) of
+    // that order are returned; ranking work for posts which can't get there
+    // is cut short. Returned data is stored in the context and is valid until
+    // its next use. Archive's search cache, if set, is consulted first.
+    // ASCII letters of terms are matched regardless of case.
+    // Only posts passing where are searched. With SF_GroupThreads, limit
+    // and offset count threads. Limited searches which skip posts that
+    // can't make it to the results don't count them, and return an estimate
+    // of the total.
+    const SearchData& Search( SearchContext& ctx, const char* query, int flags = SF_FlagsNone, int filter = T_All, size_t limit = NoLimit, size_t offset = 0, const SearchFilter& where = SearchFilter() ) const;
+    const SearchData& Search( SearchContext& ctx, const std::vector<std::string>& terms, int flags = SF_FlagsNone, int filter = T_All, size_t limit = NoLimit, size_t offset = 0, const SearchFilter& where = SearchFilter() ) const;
+
+    // Use a per-thread context and return a copy of the results.
+    SearchData Search( const char* query, int flags = SF_FlagsNone, int filter = T_All, size_t limit = NoLimit, size_t offset = 0, const SearchFilter& where = SearchFilter() ) const;
+    SearchData Search( const std::vector<std::string>& terms, int flags = SF_FlagsNone, int filter = T_All, size_t limit = NoLimit, size_t offset = 0, const SearchFilter& where = SearchFilter() ) const;
 
-    uint32_t ExtractWords( const std::vector<std::string>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const;
-    std::vector<PostDataVec> GetPostsForWords( const std::vector<WordData>& words, int filter ) const;
+private:
+    uint32_t ExtractWords( SearchContext& ctx, const std::vector<std::string>& terms, int flags ) const;
+    void Restrict( SearchContext& ctx, const SearchFilter& where ) const;
+    bool ExtendFuzzy( SearchContext& ctx, const std::string& term, const SearchContext::FuzzyTerm& f ) const;
+    size_t ExtractPhrase( SearchContext& ctx, const std::vector<std::string>& terms, size_t idx, const char* str, const char* strend, uint32_t wf, uint32_t& group ) const;
+    bool MatchPhrases( SearchContext& ctx, uint32_t postid, const PostData* const* match ) const;
+    bool HasPhrase( SearchContext& ctx, const SearchContext::Phrase& phrase, uint32_t postid ) const;
+    bool HasNegated( SearchContext& ctx, uint32_t postid ) const;
+    bool VerifyPhrase( SearchContext& ctx, uint32_t postid, const SearchContext::Phrase& phrase ) const;
+    void OpenCursor( const SearchContext& ctx, PostCursor& c, uint32_t word, int filter ) const;
+    void OpenCursors( SearchContext& ctx, int filter ) const;
     int FixupFlags( int flags ) const;
 
-    std::vector<SearchResult> GetSingleResult( const std::vector<PostDataVec>& wdata, int flags ) const;
-    std::vector<SearchResult> GetAllWordResult( const std::vector<PostDataVec>& wdata, int flags, uint32_t groups, uint32_t missing ) const;
-    std::vector<SearchResult> GetFullResult( const std::vector<PostDataVec>& wdata, const std::vector<WordData>& words, int flags, uint32_t groups, uint32_t missing ) const;
+    void GetSingleResult( SearchContext& ctx, int flags, size_t keep ) const;
+    void GetAllWordResult( SearchContext& ctx, int flags, uint32_t groups, uint32_t missing, size_t keep ) const;
+    void GetFullResult( SearchContext& ctx, int flags, uint32_t groups, uint32_t missing, size_t keep ) const;
+    bool CanSkipBlocks( const SearchContext& ctx, int flags, size_t keep ) const;
+    void GetBlockMaxResult( SearchContext& ctx, int flags, int filter, uint32_t groups, uint32_t missing, size_t keep ) const;
+    void Collect( SearchContext& ctx, int flags, size_t keep ) const;
+    void FoldThreads( SearchContext& ctx ) const;
+    bool RankPost( const SearchContext& ctx, SearchContext::Scratch& scratch, uint32_t postid, const SearchContext::Posts* posts, uint32_t num, int flags, uint32_t groups, uint32_t missing, size_t keep, SearchResult& sr ) const;
 
     const Archive& m_archive;
+    TaskDispatch* m_td;
 };
 
 #endif
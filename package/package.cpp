@@ -9,8 +9,43 @@
 
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
+#include "../common/LexiconPosting.hpp"
 #include "../common/Package.hpp"
 
+// Packages with compressed posting lists don't store lexdata and lexhit.
+// Tools working on archive directories read them, so they are rebuilt.
+static void RebuildPostings( const std::string& base )
+{
+    const FileMap<LexiconMetaPacket> meta( base + "lexmeta" );
+    const LexiconPostingView post( base + "lexpost" );
+    if( !post )
+    {
+        fprintf( stderr, "Cannot read compressed posting lists.\n" );
+        exit( 1 );
+    }
+
+    const auto words = meta.DataSize();
+    uint64_t datasize = 0;
+    for( uint32_t i=0; i<words; i++ )
+    {
+        datasize = std::max<uint64_t>( datasize, meta[i].data + uint64_t( meta[i].dataSize ) * sizeof( LexiconDataPacket ) );
+    }
+
+    std::vector<LexiconDataPacket> data( datasize / sizeof( LexiconDataPacket ) );
+    std::vector<uint8_t> hits;
+    for( uint32_t i=0; i<words; i++ )
+    {
+        post.Unpack( i, meta[i].dataSize, data.data() + meta[i].data / sizeof( LexiconDataPacket ), hits );
+    }
+
+    FILE* fdata = fopen( ( base + "lexdata" ).c_str(), "wb" );
+    FILE* fhits = fopen( ( base + "lexhit" ).c_str(), "wb" );
+    fwrite( data.data(), 1, data.size() * sizeof( LexiconDataPacket ), fdata );
+    fwrite( hits.data(), 1, hits.size(), fhits );
+    fclose( fdata );
+    fclose( fhits );
+}
+
 int main( int argc, char** argv )
 {
     if( argc < 3 )
@@ -56,19 +91,7 @@ int main( int argc, char** argv )
             fprintf( stderr, "Archive version %i is not supported. Update your tools.\n", tmp[PackageMagicSize] );
         }
 
-        int numfiles = PackageFiles;
-        if( version < 3 )
-        {
-            numfiles -= AdditionalFilesV3;
-            if( version < 2 )
-            {
-                numfiles -= AdditionalFilesV2;
-                if( version < 1 )
-                {
-                    numfiles -= AdditionalFilesV1;
-                }
-            }
-        }
+        const int numfiles = PackageFilesInVersion( version );
 
         uint64_t sizes[PackageFiles];
         for( int i=0; i<numfiles; i++ )
@@ -95,9 +118,16 @@ int main( int argc, char** argv )
                 fwrite( data, 1, todo, fout );
                 left -= todo;
             }
+            fclose( fout );
             auto align = PackageAlign( offset );
             offset += fread( tmp, 1, align - offset, fin );
         }
+        fclose( fin );
+
+        if( numfiles > PackageFile::lexpost && sizes[PackageFile::lexpost] != 0 && sizes[PackageFile::lexdata] == 0 )
+        {
+            RebuildPostings( base );
+        }
     }
     else
     {
@@ -105,9 +135,20 @@ int main( int argc, char** argv )
         std::string base( argv[1] );
         base.append( "/" );
 
+        // Hash table is not needed if there is a perfect hash for message ids.
+        const bool phf = Exists( base + PackageContents[PackageFile::midphf].filename );
+        // Raw posting data is not needed if there are compressed posting lists.
+        const bool lexpost = Exists( base + PackageContents[PackageFile::lexpost].filename );
         for( int i=0; i<PackageFiles; i++ )
         {
-            ptrs.emplace_back( base + PackageContents[i].filename, PackageContents[i].optional );
+            if( ( i == PackageFile::midhash && phf ) || ( ( i == PackageFile::lexdata || i == PackageFile::lexhit ) && lexpost ) )
+            {
+                ptrs.emplace_back( FileMapPtrs { nullptr, 0 } );
+            }
+            else
+            {
+                ptrs.emplace_back( base + PackageContents[i].filename, PackageContents[i].optional );
+            }
         }
 
         uint64_t offset = 0;
@@ -4,11 +4,14 @@
 #include <stdio.h>
 #include <string>
 #include <time.h>
+#include <vector>
 
 #include "../contrib/martinus/robin_hood.h"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/MessageLogic.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
 #include "../libuat/Archive.hpp"
 #include "../libuat/SearchEngine.hpp"
 
@@ -24,7 +27,8 @@ void PrintHelp()
     printf( "  info          - archive info\n" );
     printf( "  parent msgid  - view message's parent\n" );
     printf( "  parenti idx   - view message's parent\n" );
-    printf( "  search query  - search archive\n" );
+    printf( "  range t0 t1   - list messages dated in [t0, t1) epoch range\n" );
+    printf( "  search query  - search archive, optionally followed by result limit and offset\n" );
     printf( "  subject msgid - view subject: field\n" );
     printf( "  subjecti idx  - view subject: field\n" );
     printf( "  timechart     - print time chart\n" );
@@ -251,13 +255,16 @@ int main( int argc, char** argv )
     else if( strcmp( argv[0], "search" ) == 0 )
     {
         if( argc == 1 ) BadArg();
-        SearchEngine search( *archive );
+        TaskDispatch td( System::CPUCores() );
+        SearchEngine search( *archive, &td );
         auto t0 = std::chrono::high_resolution_clock::now();
-        auto results = search.Search( argv[1], SearchEngine::SF_AdjacentWords );
+        const size_t limit = argc > 2 ? strtoul( argv[2], nullptr, 10 ) : SearchEngine::NoLimit;
+        const size_t offset = argc > 3 ? strtoul( argv[3], nullptr, 10 ) : 0;
+        auto results = search.Search( argv[1], SearchEngine::SF_AdjacentWords, T_All, limit, offset );
         auto& data = results.results;
         auto t1 = std::chrono::high_resolution_clock::now();
         printf( "Query time %fms.\n", std::chrono::duration_cast<std::chrono::microseconds>( t1 - t0 ).count() / 1000.f );
-        printf( "Found %i messages.\n", data.size() );
+        printf( "Found %s%zu messages.\n", results.estimated ? "about " : "", results.total );
         if( !data.empty() )
         {
             bool first = true;
@@ -269,6 +276,15 @@ int main( int argc, char** argv )
             printf( "\n" );
         }
     }
+    else if( strcmp( argv[0], "range" ) == 0 )
+    {
+        if( argc < 3 ) BadArg();
+        auto range = archive->MessagesInRange( strtoul( argv[1], nullptr, 10 ), strtoul( argv[2], nullptr, 10 ) );
+        for( uint64_t i=0; i<range.size; i++ )
+        {
+            printf( "%i\n", range.ptr[i] );
+        }
+    }
     else if( strcmp( argv[0], "timechart" ) == 0 )
     {
         auto tc = archive->TimeChart();
@@ -321,16 +337,17 @@ int main( int argc, char** argv )
         const auto hlen = host ? strlen( host ) : 0;
 
         const auto num = archive->NumberOfMessages();
+        std::vector<uint32_t> all( num );
+        for( uint32_t i=0; i<num; i++ ) all[i] = i;
+
         robin_hood::unordered_flat_map<std::string, int> latest;
-        for( int i=0; i<num; i++ )
-        {
-            auto post = archive->GetMessage( i, eb );
+        archive->GetMessages( ViewReference<uint32_t> { all.data(), all.size() }, [&latest, &desc, host, hlen] ( uint32_t, const char* post, size_t ) {
             auto ptr = FindOptionalHeader( post, "xref: ", 6 );
-            if( *ptr == '\n' ) continue;
+            if( *ptr == '\n' ) return;
             ptr += 6;
             auto end = ptr;
             while( *end != ' ' ) end++;
-            if( host && ( end - ptr != hlen || strncmp( ptr, host, hlen ) != 0 ) ) continue;
+            if( host && ( end - ptr != hlen || strncmp( ptr, host, hlen ) != 0 ) ) return;
             std::string server( ptr, end );
 
             while( *end != '\n' )
@@ -360,7 +377,7 @@ int main( int argc, char** argv )
                     while( *end != '\n' && *end != ' ' ) end++;
                 }
             }
-        }
+        } );
 
         if( host )
         {
@@ -44,11 +44,8 @@ int main( int argc, char** argv )
     std::string metafn = base + "meta";
     std::string datafn = base + "data";
 
-    size_t size;
-    {
-        const ZMessageView zview( base + "zmeta", base + "zdata", base + "zdict" );
-        size = zview.Size();
-    }
+    const ZMessageView zview( base + "zmeta", base + "zdata", base + "zdict" );
+    const auto size = zview.Size();
 
     struct Buffer
     {
@@ -68,9 +65,8 @@ int main( int argc, char** argv )
 
     for( int t=0; t<cpus; t++ )
     {
-        tasks.Queue( [&cnt, size, &base, &data, t, &slab] {
+        tasks.Queue( [&cnt, size, &zview, &data, t, &slab] {
             ExpandingBuffer eb, eb_dec;
-            ZMessageView zview( base + "zmeta", base + "zdata", base + "zdict" );
             for(;;)
             {
                 auto j = cnt.fetch_add( 1, std::memory_order_relaxed );
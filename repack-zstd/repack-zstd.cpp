@@ -67,7 +67,7 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
+    MessageView mview( base + "meta", base + "data", FileAccess::Sequential );
     auto size = mview.Size();
 
     std::string zmetafn = base + "zmeta";
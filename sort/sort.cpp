@@ -6,26 +6,28 @@
 #include <string.h>
 #include <vector>
 
+#include "../common/Connectivity.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/MessageView.hpp"
-#include "../common/MetaView.hpp"
+#include "../common/MsgIdHash.hpp"
+#include "../common/PerfectHash.hpp"
 #include "../common/RawImportMeta.hpp"
+#include "../common/TimeIndex.hpp"
 
-int Expand( int idx, std::vector<uint32_t>& order, const uint32_t* data, const MetaView<uint32_t, uint32_t>& conn )
+int Expand( int idx, std::vector<uint32_t>& order, uint32_t msg, const ConnectivityView& conn )
 {
     int cskip = 1;
-    data += 3;
-    auto num = *data++;
+    auto data = conn.Children( msg );
+    auto num = conn.ChildrenCount( msg );
     idx++;
     for( int i=0; i<num; i++ )
     {
         auto child = data[i];
-        auto cdata = conn[child];
-        auto skip = cdata[2];
+        auto skip = conn.SubtreeSize( child );
         order[idx] = child;
-        auto ret = Expand( idx, order, cdata, conn );
+        auto ret = Expand( idx, order, child, conn );
         assert( ret == skip );
         idx += skip;
         cskip += skip;
@@ -54,7 +56,7 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    const ConnectivityView conn( base );
     FileMap<uint32_t> toplevel( base + "toplevel" );
 
     printf( "Sorting..." );
@@ -67,10 +69,9 @@ int main( int argc, char** argv )
     {
         order[idx] = toplevel[i];
         revtop[i] = idx;
-        auto data = conn[toplevel[i]];
-        auto ret = Expand( idx, order, data, conn );
-        assert( ret == data[2] );
-        idx += data[2];
+        auto ret = Expand( idx, order, toplevel[i], conn );
+        assert( ret == conn.SubtreeSize( toplevel[i] ) );
+        idx += conn.SubtreeSize( toplevel[i] );
     }
     assert( idx == size );
 
@@ -100,6 +101,7 @@ int main( int argc, char** argv )
     CopyFile( base + "lexhit", dbase + "lexhit" );
     CopyFile( base + "lexmeta", dbase + "lexmeta" );
     CopyFile( base + "lexstr", dbase + "lexstr" );
+    if( Exists( base + "lexdict" ) ) CopyFile( base + "lexdict", dbase + "lexdict" );
 
     printf( " done\n" );
 
@@ -183,35 +185,31 @@ int main( int argc, char** argv )
     }
 
     {
-        FILE* data = fopen( ( dbase + "conndata" ).c_str(), "wb" );
-        FILE* meta = fopen( ( dbase + "connmeta" ).c_str(), "wb" );
-        uint32_t offset = 0;
-        for( int i=0; i<conn.Size(); i++ )
+        ConnectivityWriter dst( size );
+        std::vector<uint32_t> children;
+        for( int i=0; i<size; i++ )
         {
             if( ( i & 0x3FF ) == 0 )
             {
                 printf( "conn %i/%i\r", i, size );
                 fflush( stdout );
             }
-            fwrite( &offset, 1, sizeof( offset ), meta );
 
-            auto src = conn[order[i]];
-            offset += fwrite( src++, 1, sizeof( uint32_t ), data );     // epoch
-            int32_t parent = *src++;
+            const auto src = order[i];
+            int32_t parent = conn.Parent( src );
             if( parent != -1 ) parent = rev[parent];
-            offset += fwrite( &parent, 1, sizeof( int32_t ), data );
-            offset += fwrite( src++, 1, sizeof( uint32_t ), data );     // child total
-            auto num = *src;
-            offset += fwrite( src++, 1, sizeof( uint32_t ), data );     // child num
-            for( int j=0; j<num; j++ )
+            auto cdata = conn.Children( src );
+            children.resize( conn.ChildrenCount( src ) );
+            for( int j=0; j<children.size(); j++ )
             {
-                auto child = rev[*src++];
-                offset += fwrite( &child, 1, sizeof( uint32_t ), data );
+                children[j] = rev[cdata[j]];
             }
+            dst.Add( conn.Date( src ), parent, conn.SubtreeSize( src ), children.data(), children.size() );
         }
-        fclose( data );
-        fclose( meta );
+        dst.Write( dbase );
         printf( "\n" );
+
+        TimeIndex::Write( dbase, ConnectivityView( dbase ) );
     }
 
     {
@@ -230,8 +228,11 @@ int main( int argc, char** argv )
         printf( "\n" );
     }
 
+    if( Exists( base + "midhash" ) )
     {
         FileMap<uint32_t> midhash( base + "midhash" );
+        FileMap<uint8_t> midhashdata( base + "midhashdata" );
+        const uint32_t tagMask = ( midhashdata.Size() > 1 && midhashdata[1] == HashLayoutTagged ) ? HashTagMask : 0;
         const auto hsize = midhash.DataSize() / 2;
         FILE* dst = fopen( ( dbase + "midhash" ).c_str(), "wb" );
         for( int i=0; i<hsize; i++ )
@@ -243,7 +244,8 @@ int main( int argc, char** argv )
             }
             if( midhash[i*2] > 0 )
             {
-                uint32_t idx = rev[midhash[i*2+1]];
+                const auto v = midhash[i*2+1];
+                uint32_t idx = rev[v & ~tagMask] | ( v & tagMask );
                 fwrite( midhash+i*2, 1, sizeof( uint32_t ), dst );
                 fwrite( &idx, 1, sizeof( uint32_t ), dst );
             }
@@ -257,6 +259,28 @@ int main( int argc, char** argv )
         printf( "\n" );
     }
 
+    if( Exists( base + "midphf" ) )
+    {
+        FileMap<char> midphf( base + "midphf" );
+        const auto& hdr = *(const PerfectHashHeader*)(const char*)midphf;
+        const auto slotOffset = PerfectHashSlotOffset( hdr );
+        FILE* dst = fopen( ( dbase + "midphf" ).c_str(), "wb" );
+        fwrite( midphf, 1, slotOffset, dst );
+        auto slots = (const uint32_t*)( midphf + slotOffset );
+        for( uint32_t i=0; i<hdr.keys; i++ )
+        {
+            if( ( i & 0xFFF ) == 0 )
+            {
+                printf( "midphf %i/%i\r", i, hdr.keys );
+                fflush( stdout );
+            }
+            uint32_t slot[2] = { slots[i*2], rev[slots[i*2+1]] };
+            fwrite( slot, 1, sizeof( slot ), dst );
+        }
+        fclose( dst );
+        printf( "\n" );
+    }
+
     {
         FileMap<LexiconMetaPacket> lexmeta( base + "lexmeta" );
         FileMap<LexiconDataPacket> lexdata( base + "lexdata" );
@@ -4,6 +4,7 @@
 
 #include "../common/Filesystem.hpp"
 #include "../common/UTF8.hpp"
+#include "../libuat/Archive.hpp"
 
 #include "BottomBar.hpp"
 #include "Browser.hpp"
@@ -39,6 +40,12 @@ void BottomBar::Resize()
 }
 
 std::string BottomBar::Query( const char* prompt, const char* entry, bool filesystem )
+{
+    if( !filesystem ) return Query( prompt, entry, nullptr );
+    return Query( prompt, entry, [this] ( std::string& str, int& pos ) { SuggestFiles( str, pos ); } );
+}
+
+std::string BottomBar::Query( const char* prompt, const char* entry, const std::function<void(std::string&, int&)>& complete )
 {
     std::string ret;
     int insert = 0;
@@ -120,9 +127,9 @@ std::string BottomBar::Query( const char* prompt, const char* entry, bool filesy
             m_parent->Resize();
             break;
         case '\t':
-            if( filesystem )
+            if( complete )
             {
-                SuggestFiles( ret, insert );
+                complete( ret, insert );
                 break;
             }
             // fallthrough
@@ -386,3 +393,29 @@ void BottomBar::SuggestFiles( std::string& str, int& pos ) const
         ms++;
     }
 }
+
+void BottomBar::SuggestWords( const Archive& archive, std::string& str, int& pos )
+{
+    int start = pos;
+    while( start > 0 && str[start-1] != ' ' ) start--;
+
+    // Skip search syntax in front of the word.
+    if( start < pos && ( str[start] == '+' || str[start] == '-' ) ) start++;
+    if( pos - start > 5 && strncmp( str.c_str() + start, "from:", 5 ) == 0 )
+    {
+        start += 5;
+    }
+    else if( pos - start > 8 && strncmp( str.c_str() + start, "subject:", 8 ) == 0 )
+    {
+        start += 8;
+    }
+    if( start < pos && str[start] == '"' ) start++;
+    if( start == pos ) return;
+
+    const auto list = archive.CompleteWord( str.substr( start, pos - start ).c_str(), 1 );
+    if( list.empty() ) return;
+
+    const auto len = strlen( list[0] );
+    str.replace( start, pos - start, list[0], len );
+    pos = start + len;
+}
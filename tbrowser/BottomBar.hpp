@@ -7,6 +7,7 @@
 
 #include "View.hpp"
 
+class Archive;
 class Browser;
 
 enum class HelpSet
@@ -27,9 +28,14 @@ public:
     void Resize();
 
     std::string Query( const char* prompt, const char* entry = nullptr, bool filesystem = false );
+    // Tab calls complete with the entry and the cursor position, both of which it may change.
+    std::string Query( const char* prompt, const char* entry, const std::function<void(std::string&, int&)>& complete );
     std::string InteractiveQuery( const char* prompt, const std::function<void(const std::string&)>& cb, const char* entry = nullptr );
     int KeyQuery( const char* prompt );
     void Status( const char* status, int timeout = 2 );
+
+    // Completes the search word at the cursor to the most frequent archive word starting with it.
+    static void SuggestWords( const Archive& archive, std::string& str, int& pos );
     void PushHelp( HelpSet set );
     void PopHelp();
 
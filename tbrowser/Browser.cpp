@@ -3,6 +3,8 @@
 #include <curses.h>
 
 #include "../common/MessageLogic.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
 #include "../libuat/Archive.hpp"
 #include "../libuat/Galaxy.hpp"
 #include "../libuat/PersistentStorage.hpp"
@@ -16,13 +18,14 @@ Browser::Browser( std::shared_ptr<Archive>&& archive, PersistentStorage& storage
     : m_archive( std::move( archive ) )
     , m_storage( storage )
     , m_galaxy( galaxy )
+    , m_td( std::make_unique<TaskDispatch>( System::CPUCores() ) )
     , m_header( m_archive->GetArchiveName(), m_archive->GetShortDescription().second > 0 ? m_archive->GetShortDescription().first : nullptr, fn.c_str(), galaxy != nullptr )
     , m_bottom( this )
     , m_mview( *m_archive, m_storage )
     , m_tview( *m_archive, m_storage, m_galaxy, m_mview )
-    , m_sview( this, m_bottom, *m_archive, m_storage )
+    , m_sview( this, m_bottom, *m_archive, m_storage, m_td.get() )
     , m_textview( this )
-    , m_chartview( this, *m_archive, m_bottom, m_galaxy )
+    , m_chartview( this, *m_archive, m_bottom, m_galaxy, m_td.get() )
     , m_fn( fn )
 {
     if( galaxy )
@@ -549,12 +552,14 @@ void Browser::RestoreDefaultView()
 
 void Browser::OpenArchive( std::string&& fn )
 {
-    std::shared_ptr<Archive> archive( Archive::Open( fn ) );
+    std::shared_ptr<Archive> archive( Archive::Open( fn, true ) );
     if( !archive )
     {
         m_bottom.Status( "Cannot open archive!" );
         return;
     }
+    archive->SetMessageCache( m_archive->GetMessageCache() );
+    archive->SetSearchCache( m_archive->GetSearchCache() );
 
     SwitchArchive( std::move( archive ), std::move( fn ) );
 }
@@ -17,6 +17,7 @@ class Galaxy;
 class GalaxyOpen;
 class GalaxyWarp;
 class PersistentStorage;
+class TaskDispatch;
 
 class Browser
 {
@@ -43,6 +44,7 @@ private:
     std::shared_ptr<Archive> m_archive;
     PersistentStorage& m_storage;
     Galaxy* m_galaxy;
+    std::unique_ptr<TaskDispatch> m_td;
 
     HeaderBar m_header;
     BottomBar m_bottom;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <limits>
 #include <time.h>
 
@@ -36,12 +37,13 @@ const char* Block[2][8] = {
     "\xE2\x96\x88"
 } };
 
-ChartView::ChartView( Browser* parent, Archive& archive, BottomBar& bar, Galaxy* galaxy )
+ChartView::ChartView( Browser* parent, Archive& archive, BottomBar& bar, Galaxy* galaxy, TaskDispatch* td )
     : View( 0, 1, 0, -2 )
     , m_parent( parent )
     , m_active( false )
     , m_archive( &archive )
-    , m_search( std::make_unique<SearchEngine>( archive ) )
+    , m_td( td )
+    , m_search( std::make_unique<SearchEngine>( archive, td ) )
     , m_bar( bar )
     , m_galaxy( galaxy )
     , m_hires( false )
@@ -90,7 +92,7 @@ void ChartView::Entry()
         case 's':
         case '/':
         {
-            auto query = m_bar.Query( "Search: ", m_query.c_str() );
+            auto query = m_bar.Query( "Search: ", m_query.c_str(), [this] ( std::string& str, int& pos ) { BottomBar::SuggestWords( *m_archive, str, pos ); } );
             if( !query.empty() )
             {
                 m_galaxyMode = false;
@@ -279,6 +281,31 @@ void ChartView::Draw()
     wnoutrefresh( m_win );
 }
 
+// Segment of message dated t is uint32_t( ( t - tbegin ) * tinv ). Returns first date of each segment,
+// so that whole archives can be counted with the time index instead of checking every message.
+static std::vector<uint32_t> SegmentBounds( uint32_t tbegin, uint32_t tend, int segments, double tinv )
+{
+    std::vector<uint32_t> ret( segments + 1 );
+    ret[0] = tbegin;
+    for( int k=1; k<segments; k++ )
+    {
+        auto t = std::max( ret[k-1], tbegin + uint32_t( k / tinv ) );
+        while( t > ret[k-1] && uint32_t( ( t - 1 - tbegin ) * tinv ) >= k ) t--;
+        while( t <= tend && uint32_t( ( t - tbegin ) * tinv ) < k ) t++;
+        ret[k] = t;
+    }
+    ret[segments] = tend + 1;
+    return ret;
+}
+
+static void CountSegments( const Archive& archive, const std::vector<uint32_t>& bounds, std::vector<uint32_t>& seg )
+{
+    for( size_t k=0; k<seg.size(); k++ )
+    {
+        seg[k] += archive.MessagesInRange( bounds[k], bounds[k+1] ).size;
+    }
+}
+
 void ChartView::Prepare()
 {
     int w, h;
@@ -297,30 +324,23 @@ void ChartView::Prepare()
         {
             if( !m_galaxy->IsArchiveAvailable( i ) ) continue;
             auto& arch = m_galaxy->GetArchive( i, false );
-            const auto sz = arch->NumberOfMessages();
-            for( uint32_t i=0; i<sz; i++ )
+            const auto range = arch->DateRange();
+            if( range.first != 0 )
             {
-                const auto t = arch->GetDate( i );
-                if( t != 0 )
-                {
-                    if( t < tbegin ) tbegin = t;
-                    if( t > tend ) tend = t;
-                }
+                if( range.first < tbegin ) tbegin = range.first;
+                if( range.second > tend ) tend = range.second;
             }
-            msgsz += sz;
+            msgsz += arch->NumberOfMessages();
         }
     }
     else if( m_posts.empty() || m_trend )
     {
         msgsz = m_archive->NumberOfMessages();
-        for( uint32_t i=0; i<msgsz; i++ )
+        const auto range = m_archive->DateRange();
+        if( range.first != 0 )
         {
-            const auto t = m_archive->GetDate( i );
-            if( t != 0 )
-            {
-                if( t < tbegin ) tbegin = t;
-                if( t > tend ) tend = t;
-            }
+            tbegin = range.first;
+            tend = range.second;
         }
     }
     else
@@ -348,36 +368,17 @@ void ChartView::Prepare()
 
     if( m_galaxyMode )
     {
+        const auto bounds = SegmentBounds( tbegin, tend, segments, tinv );
         const auto archsz = m_galaxy->GetNumberOfArchives();
         for( size_t i=0; i<archsz; i++ )
         {
             if( !m_galaxy->IsArchiveAvailable( i ) ) continue;
-            auto& arch = m_galaxy->GetArchive( i, false );
-            const auto sz = arch->NumberOfMessages();
-            for( uint32_t i=0; i<sz; i++ )
-            {
-                const auto t = arch->GetDate( i );
-                if( t != 0 )
-                {
-                    const auto s = uint32_t( ( t - tbegin ) * tinv );
-                    assert( s >= 0 && s < segments );
-                    seg[s]++;
-                }
-            }
+            CountSegments( *m_galaxy->GetArchive( i, false ), bounds, seg );
         }
     }
     else if( m_posts.empty() || m_trend )
     {
-        for( uint32_t i=0; i<msgsz; i++ )
-        {
-            const auto t = m_archive->GetDate( i );
-            if( t != 0 )
-            {
-                const auto s = uint32_t( ( t - tbegin ) * tinv );
-                assert( s >= 0 && s < segments );
-                seg[s]++;
-            }
-        }
+        CountSegments( *m_archive, SegmentBounds( tbegin, tend, segments, tinv ), seg );
     }
     else
     {
@@ -437,7 +438,7 @@ void ChartView::Prepare()
 void ChartView::Reset( Archive& archive )
 {
     m_archive = &archive;
-    m_search = std::make_unique<SearchEngine>( archive );
+    m_search = std::make_unique<SearchEngine>( archive, m_td );
     m_query.clear();
     m_posts.clear();
 }
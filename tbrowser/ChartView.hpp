@@ -10,11 +10,12 @@ class BottomBar;
 class Browser;
 class SearchEngine;
 class Galaxy;
+class TaskDispatch;
 
 class ChartView : public View
 {
 public:
-    ChartView( Browser* parent, Archive& archive, BottomBar& bar, Galaxy* galaxy );
+    ChartView( Browser* parent, Archive& archive, BottomBar& bar, Galaxy* galaxy, TaskDispatch* td );
 
     void Entry();
 
@@ -30,6 +31,7 @@ private:
     bool m_active;
 
     Archive* m_archive;
+    TaskDispatch* m_td;
     std::unique_ptr<SearchEngine> m_search;
     std::string m_query;
     BottomBar& m_bar;
@@ -112,11 +112,13 @@ const char* SearchHelpContents =
 "  Enter keywords you wish to search for. Search hints:\n"
 "\n"
 "  - Quote words to disable fuzzy search.\n"
+"  - Quote several words to search for an exact phrase, e.g. \"device driver\".\n"
 "  - Prepend word with from: to search for author.\n"
 "  - Prepend word with subject: to search in subject.\n"
 "  - Prepend word with + to require this word.\n"
 "  - Prepend word with - to exclude this word.\n"
-"  - Append word with * to search for any word with such beginning.\n"
+"  - Put * in a word to match any sequence of letters, e.g. linu* or *net*.\n"
+"  - Press tab to complete the word being typed.\n"
 "\n"
 "\n"
 "  For example, to require an exact match in a 'from' field, type:\n"
@@ -12,6 +12,7 @@
 #include "../common/ICU.hpp"
 #include "../common/MessageLogic.hpp"
 #include "../common/UTF8.hpp"
+#include "../contrib/martinus/robin_hood.h"
 
 #include "BottomBar.hpp"
 #include "Browser.hpp"
@@ -20,12 +21,13 @@
 #include "SearchView.hpp"
 #include "Utf8Print.hpp"
 
-SearchView::SearchView( Browser* parent, BottomBar& bar, Archive& archive, PersistentStorage& storage )
+SearchView::SearchView( Browser* parent, BottomBar& bar, Archive& archive, PersistentStorage& storage, TaskDispatch* td )
     : View( 0, 1, 0, -2 )
     , m_parent( parent )
     , m_bar( bar )
     , m_archive( &archive )
-    , m_search( std::make_unique<SearchEngine>( archive ) )
+    , m_td( td )
+    , m_search( std::make_unique<SearchEngine>( archive, td ) )
     , m_storage( storage )
     , m_active( false )
     , m_top( 0 )
@@ -55,7 +57,7 @@ void SearchView::Entry()
         case 's':
         case '/':
         {
-            auto query = m_bar.Query( "Search: ", m_query.c_str() );
+            auto query = m_bar.Query( "Search: ", m_query.c_str(), [this] ( std::string& str, int& pos ) { BottomBar::SuggestWords( *m_archive, str, pos ); } );
             if( !query.empty() )
             {
                 std::swap( m_query, query );
@@ -160,11 +162,14 @@ void SearchView::Draw()
         wattron( m_win, COLOR_PAIR( 8 ) | A_BOLD );
         mvwprintw( m_win, 6, 4, "Search hints:" );
         mvwprintw( m_win, 7, 6, "- Quote words to disable fuzzy search." );
-        mvwprintw( m_win, 8, 6, "- Prepend word with from: to search for author." );
-        mvwprintw( m_win, 9, 6, "- Prepend word with subject: to search in subject." );
-        mvwprintw( m_win, 10, 6, "- Prepend word with + to require this word." );
-        mvwprintw( m_win, 11, 6, "- Prepend word with - to exclude this word." );
-        mvwprintw( m_win, 12, 6, "- Append word with * to search for any word with such beginning." );
+        mvwprintw( m_win, 8, 6, "- Append ~1 or ~2 to a word to allow that many typos in it, e.g. kernal~1." );
+        mvwprintw( m_win, 9, 6, "- Quote several words to search for an exact phrase, e.g. \"device driver\"." );
+        mvwprintw( m_win, 10, 6, "- Prepend word with from: to search for author." );
+        mvwprintw( m_win, 11, 6, "- Prepend word with subject: to search in subject." );
+        mvwprintw( m_win, 12, 6, "- Prepend word with + to require this word." );
+        mvwprintw( m_win, 13, 6, "- Prepend word with - to exclude this word." );
+        mvwprintw( m_win, 14, 6, "- Put * in a word to match any sequence of letters, e.g. linu* or *net*." );
+        mvwprintw( m_win, 15, 6, "- Press tab to complete the word being typed." );
         wattroff( m_win, COLOR_PAIR( 8 ) | A_BOLD );
     }
     else
@@ -181,6 +186,7 @@ void SearchView::Draw()
 
         const int h = getmaxy( m_win ) - 1;
         const int w = getmaxx( m_win );
+        FillPreviews( std::min<size_t>( m_top + h, m_result.results.size() ) );
         int cnt = m_top;
         int line = 0;
         while( line < h && cnt < m_result.results.size() )
@@ -255,12 +261,7 @@ void SearchView::Draw()
             line++;
 
             int frameCol = COLOR_PAIR(6);
-            assert( cnt <= m_preview.size() );
-            if( m_preview.size() == cnt )
-            {
-                FillPreview( cnt );
-            }
-
+            assert( cnt < m_preview.size() );
             const auto& preview = m_preview[cnt];
             auto it = preview.begin();
             auto itend = preview.end();
@@ -317,7 +318,7 @@ void SearchView::Draw()
 void SearchView::Reset( Archive& archive )
 {
     m_archive = &archive;
-    m_search = std::make_unique<SearchEngine>( archive );
+    m_search = std::make_unique<SearchEngine>( archive, m_td );
     m_result.results.clear();
     m_query.clear();
     m_top = m_bottom = m_cursor = 0;
@@ -328,11 +329,41 @@ static inline bool CheckOverlap( const char* w1s, const char* w1e, const char* w
     return w1s < w2e && w1e > w2s;
 }
 
-void SearchView::FillPreview( int idx )
+// Each result takes at least one line, so there are never more than screen
+// height results visible. Their messages are read in a single batch, in
+// storage order, instead of paging them in one by one.
+void SearchView::FillPreviews( size_t end )
+{
+    const auto start = m_preview.size();
+    if( start >= end ) return;
+
+    std::vector<uint32_t> postids;
+    robin_hood::unordered_flat_map<uint32_t, size_t> slot;
+    postids.reserve( end - start );
+    for( size_t i=start; i<end; i++ )
+    {
+        const auto postid = m_result.results[i].postid;
+        postids.emplace_back( postid );
+        slot.emplace( postid, i - start );
+    }
+
+    std::vector<std::string> msgs( end - start );
+    m_archive->GetMessages( ViewReference<uint32_t> { postids.data(), postids.size() }, [&msgs, &slot] ( uint32_t idx, const char* post, size_t ) {
+        auto it = slot.find( idx );
+        assert( it != slot.end() );
+        msgs[it->second] = post;
+    } );
+
+    for( size_t i=start; i<end; i++ )
+    {
+        FillPreview( i, msgs[i - start] );
+    }
+}
+
+void SearchView::FillPreview( int idx, const std::string& msg )
 {
     const auto& res = m_result.results[idx];
 
-    auto msg = std::string( m_archive->GetMessage( res.postid, m_eb ) );
     auto content = msg.c_str();
     // skip headers
     for(;;)
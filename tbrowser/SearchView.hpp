@@ -5,7 +5,6 @@
 #include <string>
 #include <vector>
 
-#include "../common/ExpandingBuffer.hpp"
 #include "../libuat/SearchEngine.hpp"
 
 #include "View.hpp"
@@ -13,11 +12,12 @@
 class BottomBar;
 class Browser;
 class PersistentStorage;
+class TaskDispatch;
 
 class SearchView : public View
 {
 public:
-    SearchView( Browser* parent, BottomBar& bar, Archive& archive, PersistentStorage& storage );
+    SearchView( Browser* parent, BottomBar& bar, Archive& archive, PersistentStorage& storage, TaskDispatch* td );
 
     void Entry();
 
@@ -34,14 +34,15 @@ private:
         bool newline;
     };
 
-    void FillPreview( int idx );
+    void FillPreviews( size_t end );
+    void FillPreview( int idx, const std::string& msg );
     void MoveCursor( int offset );
     void FixupRank();
 
-    ExpandingBuffer m_eb;
     Browser* m_parent;
     BottomBar& m_bar;
     Archive* m_archive;
+    TaskDispatch* m_td;
     std::unique_ptr<SearchEngine> m_search;
     PersistentStorage& m_storage;
     std::string m_query;
@@ -10,6 +10,9 @@
 
 #include "Browser.hpp"
 
+enum { MessageCacheSize = 32 * 1024 * 1024 };
+enum { SearchCacheSize = 16 * 1024 * 1024 };
+
 int main( int argc, char** argv )
 {
     std::shared_ptr<Archive> archive;
@@ -58,7 +61,7 @@ int main( int argc, char** argv )
     }
     else
     {
-        archive.reset( Archive::Open( lastOpen ) );
+        archive.reset( Archive::Open( lastOpen, true ) );
     }
 
     if( !archive )
@@ -67,6 +70,19 @@ int main( int argc, char** argv )
         return 1;
     }
 
+    auto cache = std::make_shared<MessageCache>( MessageCacheSize );
+    auto searchCache = std::make_shared<SearchCache>( SearchCacheSize );
+    if( galaxy )
+    {
+        galaxy->SetMessageCache( cache );
+        galaxy->SetSearchCache( searchCache );
+    }
+    else
+    {
+        archive->SetMessageCache( cache );
+        archive->SetSearchCache( searchCache );
+    }
+
     setlocale( LC_ALL, "" );
 
     initscr();
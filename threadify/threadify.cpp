@@ -13,6 +13,7 @@
 
 #include "../libuat/Archive.hpp"
 #include "../libuat/SearchEngine.hpp"
+#include "../common/Connectivity.hpp"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/ICU.hpp"
 #include "../common/KillRe.hpp"
@@ -158,7 +159,7 @@ int main( int argc, char** argv )
     fflush( stdout );
     msgdata = new Message[size];
     {
-        MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+        const ConnectivityView conn( base );
         for( int i=0; i<size; i++ )
         {
             if( ( i & 0x3FF ) == 0 )
@@ -166,16 +167,11 @@ int main( int argc, char** argv )
                 printf( "%i/%i\r", i, size );
                 fflush( stdout );
             }
-            auto ptr = conn[i];
-            msgdata[i].epoch = *ptr++;
-            msgdata[i].parent = *ptr++;
-            msgdata[i].childTotal = *ptr++;
-            uint32_t cnum = *ptr++;
-            msgdata[i].children.reserve( cnum );
-            for( int j=0; j<cnum; j++ )
-            {
-                msgdata[i].children.push_back( *ptr++ );
-            }
+            msgdata[i].epoch = conn.Date( i );
+            msgdata[i].parent = conn.Parent( i );
+            msgdata[i].childTotal = conn.SubtreeSize( i );
+            auto children = conn.Children( i );
+            msgdata[i].children.assign( children, children + conn.ChildrenCount( i ) );
         }
     }
 
@@ -205,7 +201,7 @@ int main( int argc, char** argv )
             }
 
             auto i = toplevel[j];
-            auto post = archive->GetMessage( i, eb );
+            auto post = archive->GetMessageHeaders( i, eb );
 
             const auto refs = GetAllReferences( post, archive->GetCompress() );
 
@@ -318,14 +314,15 @@ int main( int argc, char** argv )
         TaskDispatch tasks( cpus );
         std::atomic<uint32_t> cnt( 0 );
 
-        std::mutex viewLock, resLock, splitLock;
+        std::mutex resLock, splitLock;
 
         for( int t=0; t<cpus; t++ )
         {
-            tasks.Queue( [&cnt, &topsize, &toplevel, &viewLock, &resLock, &splitLock, &archive, &search, &found, &cntnew, &cntsure, &cntbad, &cnttime, &kr] {
+            tasks.Queue( [&cnt, &topsize, &toplevel, &resLock, &splitLock, &archive, &search, &found, &cntnew, &cntsure, &cntbad, &cnttime, &kr] {
                 ExpandingBuffer eb;
                 robin_hood::unordered_flat_map<uint32_t, float> hits;
                 std::vector<std::string> wordbuf;
+                SearchContext ctx;
 
                 for(;;)
                 {
@@ -342,9 +339,11 @@ int main( int argc, char** argv )
                     bool wroteDone = false;
                     int remaining = 16;
 
-                    viewLock.lock();
-                    auto post = archive->GetMessage( i, eb );
-                    viewLock.unlock();
+                    // Quoted lines are usually at the top of the message. Decode the
+                    // rest only if the beginning doesn't have enough of them.
+                    size_t skipped;
+                    auto msg = archive->GetMessagePart( i, eb, ZMessageView::NoLimit, 64, &skipped );
+                    auto post = msg;
 
                     for(;;)
                     {
@@ -380,7 +379,7 @@ int main( int argc, char** argv )
                                     splitLock.unlock();
                                     if( !wordbuf.empty() )
                                     {
-                                        auto results = search.Search( wordbuf, SearchEngine::SF_RequireAllWords | SearchEngine::SF_SimpleSearch, T_Content );
+                                        const auto& results = search.Search( ctx, wordbuf, SearchEngine::SF_RequireAllWords | SearchEngine::SF_SimpleSearch, T_Content );
                                         auto& res = results.results;
                                         if( !res.empty() )
                                         {
@@ -402,7 +401,15 @@ int main( int argc, char** argv )
                                     while( *end != '\n' ) end--;
                                 }
                             }
-                            if( *end == '\0' ) break;
+                            if( *end == '\0' )
+                            {
+                                if( skipped == 0 ) break;
+                                const auto offset = end - msg;
+                                msg = archive->GetMessage( i, eb );
+                                skipped = 0;
+                                post = msg + offset;
+                                continue;
+                            }
                             post = end + 1;
                         }
                     }
@@ -508,9 +515,7 @@ int main( int argc, char** argv )
         fwrite( toplevel.data(), 1, sizeof( uint32_t ) * toplevel.size(), tlout );
         fclose( tlout );
 
-        FILE* cdata = fopen( ( base + "conndata" ).c_str(), "wb" );
-        FILE* cmeta = fopen( ( base + "connmeta" ).c_str(), "wb" );
-        uint32_t offset = 0;
+        ConnectivityWriter conn( size );
         for( uint32_t i=0; i<size; i++ )
         {
             if( ( i & 0x1FFF ) == 0 )
@@ -519,20 +524,9 @@ int main( int argc, char** argv )
                 fflush( stdout );
             }
 
-            fwrite( &offset, 1, sizeof( uint32_t ), cmeta );
-
-            offset += fwrite( &msgdata[i].epoch, 1, sizeof( Message::epoch ), cdata );
-            offset += fwrite( &msgdata[i].parent, 1, sizeof( Message::parent ), cdata );
-            offset += fwrite( &msgdata[i].childTotal, 1, sizeof( Message::childTotal ), cdata );
-            uint32_t cnum = msgdata[i].children.size();
-            offset += fwrite( &cnum, 1, sizeof( cnum ), cdata );
-            for( auto& v : msgdata[i].children )
-            {
-                offset += fwrite( &v, 1, sizeof( v ), cdata );
-            }
+            conn.Add( msgdata[i].epoch, msgdata[i].parent, msgdata[i].childTotal, msgdata[i].children.data(), msgdata[i].children.size() );
         }
-        fclose( cdata );
-        fclose( cmeta );
+        conn.Write( base );
 
         size_t lexsize;
         LexiconDataPacket* lexdata;
@@ -553,6 +547,8 @@ int main( int argc, char** argv )
         FILE* flex = fopen( ( base + "lexdata" ).c_str(), "wb" );
         fwrite( lexdata, 1, lexsize * sizeof( LexiconDataPacket ), flex );
         fclose( flex );
+        // Child counts in compressed posting lists are now stale, lexsort will write them again.
+        remove( ( base + "lexpost" ).c_str() );
     }
 
     printf( "\nFound %i new threads.\nSurely matched %i messages (same subject line). Wrong guesses: %i due to different subject + %i non-chronological\n", cntnew, cntsure, cntbad, cnttime );
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <inttypes.h>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "../../common/ExpandingBuffer.hpp"
+#include "../../common/System.hpp"
+#include "../../common/TaskDispatch.hpp"
+#include "../../libuat/Archive.hpp"
+
+// Decodes every message of an archive using an increasing number of threads,
+// all sharing a single Archive instance without any external locking. Then
+// checks that partial decoding done by many threads gives the same text as
+// cutting fully decoded messages on a single thread.
+
+static double Run( const Archive& archive, int threads, uint64_t& bytes )
+{
+    const uint32_t size = archive.NumberOfMessages();
+    std::atomic<uint32_t> cnt( 0 );
+    std::atomic<uint64_t> total( 0 );
+    std::vector<std::thread> workers;
+    workers.reserve( threads );
+
+    const auto t0 = std::chrono::high_resolution_clock::now();
+    for( int t=0; t<threads; t++ )
+    {
+        workers.emplace_back( [&archive, &cnt, &total, size] {
+            ExpandingBuffer eb;
+            uint64_t local = 0;
+            for(;;)
+            {
+                const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( i >= size ) break;
+                auto msg = archive.GetMessage( i, eb );
+                local += strlen( msg );
+            }
+            total.fetch_add( local, std::memory_order_relaxed );
+        } );
+    }
+    for( auto& v : workers ) v.join();
+    const auto t1 = std::chrono::high_resolution_clock::now();
+
+    bytes = total.load();
+    return std::chrono::duration_cast<std::chrono::microseconds>( t1 - t0 ).count() / 1000.0;
+}
+
+static double RunBatched( const Archive& archive, TaskDispatch* td, uint64_t& bytes )
+{
+    const uint32_t size = archive.NumberOfMessages();
+    std::vector<uint32_t> idx( size );
+    for( uint32_t i=0; i<size; i++ ) idx[i] = i;
+    std::atomic<uint64_t> total( 0 );
+
+    const auto t0 = std::chrono::high_resolution_clock::now();
+    archive.GetMessages( ViewReference<uint32_t> { idx.data(), idx.size() }, [&total] ( uint32_t, const char*, size_t len ) {
+        total.fetch_add( len, std::memory_order_relaxed );
+    }, td );
+    const auto t1 = std::chrono::high_resolution_clock::now();
+
+    bytes = total.load();
+    return std::chrono::duration_cast<std::chrono::microseconds>( t1 - t0 ).count() / 1000.0;
+}
+
+// Length of the text partial decoding should return: headers, including the
+// empty line ending them, and at most bodyLines lines after them.
+static size_t PartLength( const char* msg, size_t size, size_t bodyLines )
+{
+    size_t lines = 0;
+    bool body = false;
+    for( size_t i=0; i<size; i++ )
+    {
+        if( msg[i] != '\n' ) continue;
+        if( !body )
+        {
+            if( i != 0 && msg[i-1] != '\n' ) continue;
+            body = true;
+            if( bodyLines == 0 ) return i+1;
+        }
+        else if( ++lines == bodyLines )
+        {
+            return i+1;
+        }
+    }
+    return size;
+}
+
+static uint32_t CheckParts( const Archive& archive, int threads, size_t bodyLines )
+{
+    const uint32_t size = archive.NumberOfMessages();
+    std::vector<uint32_t> idx( size );
+    for( uint32_t i=0; i<size; i++ ) idx[i] = i;
+    std::vector<std::string> ref( size );
+    std::vector<size_t> full( size );
+    archive.GetMessages( ViewReference<uint32_t> { idx.data(), idx.size() }, [&ref, &full, bodyLines] ( uint32_t i, const char* msg, size_t len ) {
+        ref[i].assign( msg, PartLength( msg, len, bodyLines ) );
+        full[i] = len;
+    } );
+
+    std::atomic<uint32_t> cnt( 0 );
+    std::atomic<uint32_t> bad( 0 );
+    std::vector<std::thread> workers;
+    workers.reserve( threads );
+    for( int t=0; t<threads; t++ )
+    {
+        workers.emplace_back( [&archive, &cnt, &bad, &ref, &full, size, bodyLines] {
+            ExpandingBuffer eb;
+            for(;;)
+            {
+                const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( i >= size ) break;
+                size_t skipped;
+                auto part = archive.GetMessagePart( i, eb, ZMessageView::NoLimit, bodyLines, &skipped );
+                if( ref[i] != part || ref[i].size() + skipped != full[i] )
+                {
+                    bad.fetch_add( 1, std::memory_order_relaxed );
+                }
+            }
+        } );
+    }
+    for( auto& v : workers ) v.join();
+    return bad.load();
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        fprintf( stderr, "USAGE: %s archive [max threads]\n", argv[0] );
+        exit( 1 );
+    }
+
+    std::unique_ptr<Archive> archive( Archive::Open( argv[1] ) );
+    if( !archive )
+    {
+        fprintf( stderr, "Cannot open %s\n", argv[1] );
+        exit( 1 );
+    }
+
+    const int maxThreads = argc > 2 ? std::max( 1, atoi( argv[2] ) ) : System::CPUCores();
+    const auto size = archive->NumberOfMessages();
+
+    uint64_t bytes;
+    printf( "Warming up page cache (%zu messages)...\n", size );
+    Run( *archive, maxThreads, bytes );
+
+    printf( "threads       time       msg/s        MB/s  speedup\n" );
+    double base = 0;
+    for( int t=1; ; t = std::min( t*2, maxThreads ) )
+    {
+        const auto ms = Run( *archive, t, bytes );
+        if( t == 1 ) base = ms;
+        printf( "%7i %8.2f ms %11.0f %11.2f %7.2fx\n", t, ms, size / ms * 1000, bytes / ms / 1000, base / ms );
+        fflush( stdout );
+        if( t == maxThreads ) break;
+    }
+
+    auto ms = RunBatched( *archive, nullptr, bytes );
+    printf( "batched %8.2f ms %11.0f %11.2f %7.2fx\n", ms, size / ms * 1000, bytes / ms / 1000, base / ms );
+    TaskDispatch td( maxThreads );
+    ms = RunBatched( *archive, &td, bytes );
+    printf( "batch/mt %7.2f ms %11.0f %11.2f %7.2fx\n", ms, size / ms * 1000, bytes / ms / 1000, base / ms );
+
+    auto cache = std::make_shared<MessageCache>( 256 * 1024 * 1024 );
+    archive->SetMessageCache( cache );
+    Run( *archive, 1, bytes );
+    ms = Run( *archive, 1, bytes );
+    printf( "cached  %8.2f ms %11.0f %11.2f %7.2fx\n", ms, size / ms * 1000, bytes / ms / 1000, base / ms );
+    printf( "Cache: %.2f MB used, %" PRIu64 " hits, %" PRIu64 " misses\n", cache->Used() / 1024.0 / 1024.0, cache->Hits(), cache->Misses() );
+
+    uint32_t bad = 0;
+    for( size_t lines : { size_t( 0 ), size_t( 16 ), size_t( 64 ) } )
+    {
+        const auto mismatch = CheckParts( *archive, maxThreads, lines );
+        printf( "Partial decode, %zu body lines: %s (%u mismatches)\n", lines, mismatch == 0 ? "ok" : "FAIL", mismatch );
+        bad += mismatch;
+    }
+
+    return bad == 0 ? 0 : 1;
+}
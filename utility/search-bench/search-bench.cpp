@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../../common/FileMap.hpp"
+#include "../../common/Filesystem.hpp"
+#include "../../common/TaskDispatch.hpp"
+#include "../../libuat/Archive.hpp"
+#include "../../libuat/SearchCache.hpp"
+#include "../../libuat/SearchEngine.hpp"
+
+// Replays a file of search queries, one per line, against an archive and
+// reports query latency, result counts and time spent in each search phase.
+
+struct Run
+{
+    uint32_t query;
+    uint64_t ns;
+    size_t results;
+    size_t total;
+    bool estimated;
+    SearchProfile profile;
+};
+
+static int ParseFlags( const char* str )
+{
+    int flags = SearchEngine::SF_FlagsNone;
+    for( ; *str; str++ )
+    {
+        switch( *str )
+        {
+        case 'a': flags |= SearchEngine::SF_AdjacentWords; break;
+        case 'r': flags |= SearchEngine::SF_RequireAllWords; break;
+        case 'f': flags |= SearchEngine::SF_FuzzySearch; break;
+        case 'l': flags |= SearchEngine::SF_SetLogic; break;
+        case 's': flags |= SearchEngine::SF_SimpleSearch; break;
+        case 't': flags |= SearchEngine::SF_GroupThreads; break;
+        case '-': break;
+        default:
+            fprintf( stderr, "Unknown search flag: %c\n", *str );
+            exit( 1 );
+        }
+    }
+    return flags;
+}
+
+static std::vector<std::string> LoadQueries( const char* fn )
+{
+    std::vector<std::string> ret;
+    const FileMap<char> file( fn );
+    auto ptr = (const char*)file;
+    const auto end = ptr + file.DataSize();
+    while( ptr != end )
+    {
+        auto eol = ptr;
+        while( eol != end && *eol != '\r' && *eol != '\n' ) eol++;
+        if( eol != ptr ) ret.emplace_back( ptr, eol );
+        ptr = eol;
+        while( ptr != end && ( *ptr == '\r' || *ptr == '\n' ) ) ptr++;
+    }
+    return ret;
+}
+
+// Drops archive files from the page cache. Works only for files which are
+// not mapped by anyone, so the archive has to be closed first.
+static void Evict( const std::string& path )
+{
+    std::vector<std::string> files;
+    if( IsFile( path ) )
+    {
+        files.emplace_back( path );
+    }
+    else
+    {
+        for( auto& v : ListDirectory( path ) ) files.emplace_back( path + "/" + v );
+    }
+    for( auto& v : files )
+    {
+        const auto fd = open( v.c_str(), O_RDONLY );
+        if( fd < 0 ) continue;
+        posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+        close( fd );
+    }
+}
+
+static std::unique_ptr<Archive> OpenArchive( const char* fn, const std::shared_ptr<SearchCache>& cache )
+{
+    std::unique_ptr<Archive> archive( Archive::Open( fn ) );
+    if( !archive )
+    {
+        fprintf( stderr, "Cannot open %s\n", fn );
+        exit( 1 );
+    }
+    if( cache ) archive->SetSearchCache( cache );
+    return archive;
+}
+
+static Run Search( const SearchEngine& engine, SearchContext& ctx, const std::vector<std::string>& queries, uint32_t idx, int flags, size_t limit )
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto& data = engine.Search( ctx, queries[idx].c_str(), flags, T_All, limit );
+    const auto t1 = std::chrono::steady_clock::now();
+    return Run { idx, uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>( t1 - t0 ).count() ), data.results.size(), data.total, data.estimated, ctx.GetProfile() };
+}
+
+// Nearest rank percentile of sorted values.
+static uint64_t Percentile( const std::vector<uint64_t>& sorted, double p )
+{
+    if( sorted.empty() ) return 0;
+    const auto rank = size_t( p * sorted.size() + 0.999999 );
+    return sorted[std::min( sorted.size(), std::max<size_t>( rank, 1 ) ) - 1];
+}
+
+static double Ms( uint64_t ns ) { return ns / 1000000.0; }
+
+static void PrintJsonString( const char* str )
+{
+    putchar( '"' );
+    for( ; *str; str++ )
+    {
+        const auto c = uint8_t( *str );
+        if( c == '"' || c == '\\' ) printf( "\\%c", c );
+        else if( c < 0x20 ) printf( "\\u%04x", c );
+        else putchar( c );
+    }
+    putchar( '"' );
+}
+
+int main( int argc, char** argv )
+{
+    const char* flagstr = "afl";
+    size_t limit = 100;
+    int passes = 5;
+    bool cold = false;
+    int threads = 1;
+    int workers = 0;
+    size_t cacheMb = 0;
+    bool machine = false;
+
+    if( argc < 3 )
+    {
+        fprintf( stderr, "USAGE: %s [params] archive queries\nParams:\n", argv[0] );
+        fprintf( stderr, " -f flags        - search flags: a(djacent) r(equire all) f(uzzy) (set )l(ogic) s(imple) t(hreads), - for none (default: %s)\n", flagstr );
+        fprintf( stderr, " -l limit        - results per query, 0 for all (default: %zu)\n", limit );
+        fprintf( stderr, " -r passes       - measured passes over the query file (default: %i)\n", passes );
+        fprintf( stderr, " -c              - cold cache, archive is evicted from page cache before each query\n" );
+        fprintf( stderr, " -t threads      - replay queries on this many threads at once (default: %i)\n", threads );
+        fprintf( stderr, " -w workers      - rank each query on this many workers (default: none)\n" );
+        fprintf( stderr, " -C megabytes    - enable search cache of given size\n" );
+        fprintf( stderr, " -m              - machine readable output, in JSON\n" );
+        exit( 1 );
+    }
+
+    for(;;)
+    {
+        if( strcmp( argv[1], "-f" ) == 0 )
+        {
+            flagstr = argv[2];
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-l" ) == 0 )
+        {
+            const char* str = argv[2];
+            char* end;
+            errno = 0;
+            const auto v = str ? strtoul( str, &end, 10 ) : 0;
+            if( !str || *str < '0' || *str > '9' || *end != '\0' || errno == ERANGE )
+            {
+                fprintf( stderr, "Invalid result limit: %s\n", str ? str : "(none)" );
+                exit( 1 );
+            }
+            limit = v == 0 ? size_t( SearchEngine::NoLimit ) : size_t( v );
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-r" ) == 0 )
+        {
+            passes = std::max( 1, atoi( argv[2] ) );
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-c" ) == 0 )
+        {
+            cold = true;
+            argv++;
+        }
+        else if( strcmp( argv[1], "-t" ) == 0 )
+        {
+            threads = std::max( 1, atoi( argv[2] ) );
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-w" ) == 0 )
+        {
+            workers = std::max( 0, atoi( argv[2] ) );
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-C" ) == 0 )
+        {
+            cacheMb = std::max( 0, atoi( argv[2] ) );
+            argv += 2;
+        }
+        else if( strcmp( argv[1], "-m" ) == 0 )
+        {
+            machine = true;
+            argv++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if( !argv[1] || !argv[2] )
+    {
+        fprintf( stderr, "Missing archive or query file.\n" );
+        exit( 1 );
+    }
+    if( threads > 1 && ( workers > 0 || cold ) )
+    {
+        fprintf( stderr, "Multiple threads can't be used with ranking workers or cold cache.\n" );
+        exit( 1 );
+    }
+    if( !Exists( argv[2] ) )
+    {
+        fprintf( stderr, "Query file doesn't exist.\n" );
+        exit( 1 );
+    }
+
+    const char* fn = argv[1];
+    const auto queries = LoadQueries( argv[2] );
+    if( queries.empty() )
+    {
+        fprintf( stderr, "No queries to run.\n" );
+        exit( 1 );
+    }
+    const auto flags = ParseFlags( flagstr );
+    const auto qsize = uint32_t( queries.size() );
+
+    std::shared_ptr<SearchCache> cache;
+    if( cacheMb > 0 ) cache = std::make_shared<SearchCache>( cacheMb * 1024 * 1024 );
+    std::unique_ptr<TaskDispatch> td;
+    if( workers > 0 ) td = std::make_unique<TaskDispatch>( workers );
+
+    std::vector<Run> runs;
+    runs.reserve( size_t( qsize ) * passes * threads );
+    std::chrono::steady_clock::time_point t0, t1;
+
+    if( cold )
+    {
+        SearchContext ctx;
+        ctx.EnableProfile( true );
+        t0 = std::chrono::steady_clock::now();
+        for( int p=0; p<passes; p++ )
+        {
+            for( uint32_t i=0; i<qsize; i++ )
+            {
+                Evict( fn );
+                auto archive = OpenArchive( fn, cache );
+                SearchEngine engine( *archive, td.get() );
+                runs.emplace_back( Search( engine, ctx, queries, i, flags, limit ) );
+            }
+        }
+        t1 = std::chrono::steady_clock::now();
+    }
+    else
+    {
+        auto archive = OpenArchive( fn, cache );
+        const SearchEngine engine( *archive, td.get() );
+
+        // Unmeasured pass brings the archive into memory. Search cache is
+        // reset afterwards, so that its hit rate is that of the replayed log.
+        {
+            SearchContext ctx;
+            for( uint32_t i=0; i<qsize; i++ ) engine.Search( ctx, queries[i].c_str(), flags, T_All, limit );
+            if( cache ) cache = std::make_shared<SearchCache>( cache->Budget() );
+            archive->SetSearchCache( cache );
+        }
+
+        std::vector<std::vector<Run>> local( threads );
+        std::vector<std::thread> jobs;
+        jobs.reserve( threads );
+        t0 = std::chrono::steady_clock::now();
+        for( int t=0; t<threads; t++ )
+        {
+            jobs.emplace_back( [&engine, &queries, &local, t, qsize, passes, flags, limit] {
+                SearchContext ctx;
+                ctx.EnableProfile( true );
+                auto& out = local[t];
+                out.reserve( size_t( qsize ) * passes );
+                // Threads start at different points of the log, so that they don't run the same query at once.
+                const auto start = uint32_t( uint64_t( qsize ) * t / std::max<size_t>( 1, local.size() ) );
+                for( int p=0; p<passes; p++ )
+                {
+                    for( uint32_t i=0; i<qsize; i++ ) out.emplace_back( Search( engine, ctx, queries, ( start + i ) % qsize, flags, limit ) );
+                }
+            } );
+        }
+        for( auto& v : jobs ) v.join();
+        t1 = std::chrono::steady_clock::now();
+        for( auto& v : local ) runs.insert( runs.end(), v.begin(), v.end() );
+    }
+
+    const auto wall = uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>( t1 - t0 ).count() );
+
+    std::vector<uint64_t> lat;
+    lat.reserve( runs.size() );
+    uint64_t sum = 0;
+    SearchProfile phases;
+    size_t cached = 0;
+    for( auto& v : runs )
+    {
+        lat.emplace_back( v.ns );
+        sum += v.ns;
+        phases.words += v.profile.words;
+        phases.posts += v.profile.posts;
+        phases.rank += v.profile.rank;
+        phases.sort += v.profile.sort;
+        if( v.profile.cached ) cached++;
+    }
+    std::sort( lat.begin(), lat.end() );
+
+    // Per query statistics. Runs of a query give the same results, every run is timed.
+    struct QueryStats
+    {
+        std::vector<uint64_t> ns;
+        size_t results;
+        size_t total;
+        bool estimated;
+        SearchProfile profile;
+    };
+    std::vector<QueryStats> qstats( qsize );
+    for( auto& v : runs )
+    {
+        auto& q = qstats[v.query];
+        q.ns.emplace_back( v.ns );
+        q.results = v.results;
+        q.total = v.total;
+        q.estimated = v.estimated;
+        q.profile.words += v.profile.words;
+        q.profile.posts += v.profile.posts;
+        q.profile.rank += v.profile.rank;
+        q.profile.sort += v.profile.sort;
+    }
+    for( auto& v : qstats ) std::sort( v.ns.begin(), v.ns.end() );
+
+    const auto nruns = runs.size();
+    const char* mode = cold ? "cold" : "warm";
+    if( machine )
+    {
+        printf( "{\n  \"archive\": " );
+        PrintJsonString( fn );
+        printf( ",\n  \"flags\": " );
+        PrintJsonString( flagstr );
+        printf( ",\n  \"limit\": %" PRIi64 ",\n", limit == SearchEngine::NoLimit ? int64_t( 0 ) : int64_t( limit ) );
+        printf( "  \"mode\": \"%s\",\n  \"threads\": %i,\n  \"workers\": %i,\n  \"passes\": %i,\n", mode, threads, workers, passes );
+        printf( "  \"queries\": %u,\n  \"runs\": %zu,\n  \"wall_ms\": %.3f,\n  \"qps\": %.1f,\n", qsize, nruns, Ms( wall ), nruns / ( wall / 1e9 ) );
+        printf( "  \"latency_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n", Ms( sum ) / nruns, Ms( Percentile( lat, 0.5 ) ), Ms( Percentile( lat, 0.95 ) ), Ms( Percentile( lat, 0.99 ) ), Ms( lat.back() ) );
+        printf( "  \"phase_ms\": { \"words\": %.4f, \"posts\": %.4f, \"rank\": %.4f, \"sort\": %.4f },\n", Ms( phases.words ) / nruns, Ms( phases.posts ) / nruns, Ms( phases.rank ) / nruns, Ms( phases.sort ) / nruns );
+        printf( "  \"cached_runs\": %zu,\n  \"per_query\": [\n", cached );
+        for( uint32_t i=0; i<qsize; i++ )
+        {
+            const auto& q = qstats[i];
+            const auto n = q.ns.size();
+            printf( "    { \"query\": " );
+            PrintJsonString( queries[i].c_str() );
+            printf( ", \"results\": %zu, \"total\": %zu, \"estimated\": %s, \"p50_ms\": %.4f, \"max_ms\": %.4f, \"words_ms\": %.4f, \"posts_ms\": %.4f, \"rank_ms\": %.4f, \"sort_ms\": %.4f }%s\n",
+                q.results, q.total, q.estimated ? "true" : "false", Ms( Percentile( q.ns, 0.5 ) ), Ms( q.ns.back() ), Ms( q.profile.words ) / n, Ms( q.profile.posts ) / n, Ms( q.profile.rank ) / n, Ms( q.profile.sort ) / n, i+1 == qsize ? "" : "," );
+        }
+        printf( "  ]\n}\n" );
+    }
+    else
+    {
+        printf( "%u queries, %zu runs (%s, %i thread(s), %i worker(s), flags %s)\n", qsize, nruns, mode, threads, workers, flagstr );
+        printf( "Wall time %.2f ms, %.1f queries/s\n", Ms( wall ), nruns / ( wall / 1e9 ) );
+        printf( "Latency:    mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n", Ms( sum ) / nruns, Ms( Percentile( lat, 0.5 ) ), Ms( Percentile( lat, 0.95 ) ), Ms( Percentile( lat, 0.99 ) ), Ms( lat.back() ) );
+        printf( "Phases:     words %.3f ms, posts %.3f ms, rank %.3f ms, sort %.3f ms (mean per run)\n", Ms( phases.words ) / nruns, Ms( phases.posts ) / nruns, Ms( phases.rank ) / nruns, Ms( phases.sort ) / nruns );
+        if( cache ) printf( "Cache:      %zu of %zu runs served from cache, %.2f MB used\n", cached, nruns, cache->Used() / 1024.0 / 1024.0 );
+
+        std::vector<uint32_t> slow( qsize );
+        for( uint32_t i=0; i<qsize; i++ ) slow[i] = i;
+        const auto show = std::min<size_t>( 10, qsize );
+        std::partial_sort( slow.begin(), slow.begin() + show, slow.end(), [&qstats] ( uint32_t l, uint32_t r ) { return Percentile( qstats[l].ns, 0.5 ) > Percentile( qstats[r].ns, 0.5 ); } );
+        printf( "\nSlowest queries (p50):\n" );
+        for( size_t i=0; i<show; i++ )
+        {
+            const auto& q = qstats[slow[i]];
+            printf( "%10.3f ms %8zu results %9zu total%s  %s\n", Ms( Percentile( q.ns, 0.5 ) ), q.results, q.total, q.estimated ? " (est.)" : "", queries[slow[i]].c_str() );
+        }
+    }
+
+    return 0;
+}
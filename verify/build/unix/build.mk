@@ -2,7 +2,7 @@ CFLAGS +=
 CXXFLAGS := $(CFLAGS) -std=c++14
 DEFINES += -D_GNU_SOURCE
 INCLUDES := -I../../../contrib/zstd/common -I../../../contrib/zstd
-LIBS :=
+LIBS := -lpthread
 IMAGE := verify
 
 SRC := $(shell egrep 'ClCompile.*cpp"' ../win32/$(IMAGE).vcxproj | sed -e 's/.*\"\(.*\)\".*/\1/' | sed -e 's@\\@/@g')
@@ -345,17 +345,21 @@ int main( int argc, char** argv )
     const char* port = "8119";
     const char* galaxyPath = "news/galaxy";
     const char* chompStr = "0";
+    const char* cacheStr = "64";
+    const char* warmStr = "1";
 
     TryIni( bind, config, "server", "bind" );
     TryIni( port, config, "server", "port" );
     TryIni( chompStr, config, "server", "chomp" );
     TryIni( tracker, config, "server", "tracker" );
     TryIni( galaxyPath, config, "galaxy", "path" );
+    TryIni( cacheStr, config, "galaxy", "cache" );
+    TryIni( warmStr, config, "galaxy", "warm" );
 
     chomp = atoi( chompStr );
     trackerLen = strlen( tracker );
 
-    galaxy.reset( Galaxy::Open( galaxyPath ) );
+    galaxy.reset( Galaxy::Open( galaxyPath, atoi( warmStr ) != 0 ) );
     if( !galaxy )
     {
         fprintf( stderr, "Cannot access galaxy at %s!\n", galaxyPath );
@@ -363,6 +367,7 @@ int main( int argc, char** argv )
         ini_free( config );
         return 3;
     }
+    galaxy->SetMessageCache( std::make_shared<MessageCache>( size_t( atoi( cacheStr ) ) * 1024 * 1024 ) );
 
     char address[1024];
     snprintf( address, 1024, "%s:%s", bind, port );